@@ -0,0 +1,467 @@
+// Copyright 2020 Richard W. Van Tassel. All Rights Reserved.
+
+#include "STOMPClientCore.h"
+#include "IStompMessage.h"
+#include "STOMPWebSocketMessage.h"
+#include "STOMPReplayMessage.h"
+#include "STOMPScheduledSend.h"
+#include "STOMPSharedTicker.h"
+#include "STOMPWebSockets.h"
+#include "Misc/Guid.h"
+
+FSTOMPClientCore::FSTOMPClientCore(UObject* InOwner)
+	: Owner(InOwner)
+	, bRecycleMessages(false)
+	, MessagesDispatched(0)
+	, MessageObjectsCreated(0)
+{
+}
+
+FSTOMPClientCore::~FSTOMPClientCore()
+{
+	FSTOMPSharedTicker::Get().Remove(PeriodicFlushHandle);
+}
+
+void FSTOMPClientCore::SetStompClient(const TSharedPtr<IStompClient>& InStompClient)
+{
+	StompClient = InStompClient;
+
+	// Server subscriptions belonged to the previous client, replay-only ones to no client at all
+	for (TMap<FString, FSubscription>::TIterator It = Subscriptions.CreateIterator(); It; ++It)
+	{
+		if (!It.Value().bReplayOnly)
+		{
+			It.RemoveCurrent();
+		}
+	}
+}
+
+void FSTOMPClientCore::HandleConnected()
+{
+	DrainOutboundJournal();
+}
+
+void FSTOMPClientCore::HandleDisconnected()
+{
+	if (OutboundJournal.IsValid())
+	{
+		OutboundJournal->RequeueInFlight();
+	}
+}
+
+FString FSTOMPClientCore::Subscribe(const FString& Destination, const FSTOMPMessageEvent& EventCallback, const FStompRequestCompleted& CompletionCallback)
+{
+	if (!StompClient.IsValid())
+	{
+		UE_LOG(LogSTOMPWebSockets, Warning, TEXT("Cannot subscribe to %s before the client is built. Use SubscribeForReplay to receive replayed captures offline."), *Destination);
+		CompletionCallback.ExecuteIfBound(false, TEXT("Client not built"));
+		return FString();
+	}
+
+	const FString SubscriptionId = StompClient->Subscribe(Destination,
+		FStompSubscriptionEvent::CreateSP(this, &FSTOMPClientCore::HandleMessage, EventCallback),
+		CompletionCallback);
+
+	Subscriptions.Add(SubscriptionId, { Destination, EventCallback, false });
+	if (TrafficCapture.IsValid())
+	{
+		TrafficCapture->Record(FSTOMPTrafficCapture::EDirection::Outbound, FSTOMPTrafficCapture::ECommand::Subscribe,
+			Destination, SubscriptionId, TMap<FName, FString>());
+	}
+	return SubscriptionId;
+}
+
+FString FSTOMPClientCore::SubscribeForReplay(const FString& Destination, const FSTOMPMessageEvent& EventCallback)
+{
+	// Never sent to the server, so the id only has to be unique among this client's subscriptions
+	const FString SubscriptionId = FGuid::NewGuid().ToString();
+	Subscriptions.Add(SubscriptionId, { Destination, EventCallback, true });
+	return SubscriptionId;
+}
+
+void FSTOMPClientCore::Unsubscribe(const FString& Subscription, const FStompRequestCompleted& CompletionCallback)
+{
+	FSubscription Existing;
+	const bool bFound = Subscriptions.RemoveAndCopyValue(Subscription, Existing);
+	if (bFound && Existing.bReplayOnly)
+	{
+		CompletionCallback.ExecuteIfBound(true, FString());
+		return;
+	}
+
+	if (TrafficCapture.IsValid())
+	{
+		TrafficCapture->Record(FSTOMPTrafficCapture::EDirection::Outbound, FSTOMPTrafficCapture::ECommand::Unsubscribe,
+			bFound ? Existing.Destination : FString(), Subscription, TMap<FName, FString>());
+	}
+
+	if (!StompClient.IsValid())
+	{
+		CompletionCallback.ExecuteIfBound(false, TEXT("Client not built"));
+		return;
+	}
+
+	StompClient->Unsubscribe(Subscription, CompletionCallback);
+}
+
+void FSTOMPClientCore::Send(const FString& Destination, const TArray<uint8>& Body, const TMap<FName, FString>& Header,
+	const FStompRequestCompleted& CompletionCallback, ESTOMPTrafficLane Lane)
+{
+	if (TrafficCapture.IsValid())
+	{
+		TrafficCapture->Record(FSTOMPTrafficCapture::EDirection::Outbound, FSTOMPTrafficCapture::ECommand::Send,
+			Destination, FString(), Header, Body.GetData(), Body.Num());
+	}
+
+	if (OutboundJournal.IsValid())
+	{
+		uint64 Sequence = 0;
+		TArray<uint64> Evicted;
+		const bool bAppended = OutboundJournal->Append(Destination, Body, Header, Sequence, Evicted);
+		FailJournalCallbacks(Evicted, TEXT("Frame evicted from the outbound journal"));
+		if (!bAppended)
+		{
+			CompletionCallback.ExecuteIfBound(false, TEXT("Frame rejected by the outbound journal"));
+			return;
+		}
+
+		if (CompletionCallback.IsBound())
+		{
+			JournalCallbacks.Add(Sequence, CompletionCallback);
+		}
+		DrainOutboundJournal();
+		return;
+	}
+
+	ScheduleStompSend(OutboundScheduler, StompClient, Lane, Destination, Body, Header, CompletionCallback);
+	OnQueuedWorkChanged.ExecuteIfBound();
+}
+
+void FSTOMPClientCore::SetDestinationLane(const FString& Destination, ESTOMPTrafficLane Lane)
+{
+	OutboundScheduler.SetDestinationLane(Destination, Lane);
+}
+
+void FSTOMPClientCore::SetOutboundSchedule(int32 InteractiveWeight, int32 BulkWeight, int32 BulkBytesPerTick)
+{
+	OutboundScheduler.Configure(InteractiveWeight, BulkWeight, BulkBytesPerTick);
+}
+
+bool FSTOMPClientCore::EnableOutboundJournal(const FString& JournalPath, int64 MaxBytes, ESTOMPJournalOverflowPolicy OverflowPolicy, float DrainRate)
+{
+	DisableOutboundJournal();
+
+	TSharedPtr<FSTOMPOutboundJournal> Journal = MakeShared<FSTOMPOutboundJournal>(JournalPath, MaxBytes, OverflowPolicy, DrainRate);
+	if (!Journal->Open())
+	{
+		return false;
+	}
+
+	OutboundJournal = Journal;
+	UpdatePeriodicFlush();
+	DrainOutboundJournal();
+	return true;
+}
+
+void FSTOMPClientCore::DisableOutboundJournal()
+{
+	TMap<uint64, FStompRequestCompleted> Outstanding = MoveTemp(JournalCallbacks);
+	JournalCallbacks.Reset();
+	OutboundJournal.Reset();
+	UpdatePeriodicFlush();
+	OnQueuedWorkChanged.ExecuteIfBound();
+
+	for (const TPair<uint64, FStompRequestCompleted>& Pair : Outstanding)
+	{
+		Pair.Value.ExecuteIfBound(false, TEXT("Outbound journal disabled"));
+	}
+}
+
+int32 FSTOMPClientCore::GetJournaledFrameCount() const
+{
+	return OutboundJournal.IsValid() ? OutboundJournal->Num() : 0;
+}
+
+void FSTOMPClientCore::DrainOutboundJournal()
+{
+	if (OutboundJournal.IsValid() && StompClient.IsValid() && StompClient->IsConnected())
+	{
+		TArray<uint64> Dropped;
+		OutboundJournal->Drain([this](const FSTOMPOutboundJournal::FFrame& Frame)
+		{
+			SendJournaledFrame(Frame);
+		}, Dropped);
+		FailJournalCallbacks(Dropped, TEXT("Frame could not be read back from the outbound journal"));
+	}
+	OnQueuedWorkChanged.ExecuteIfBound();
+}
+
+void FSTOMPClientCore::SendJournaledFrame(const FSTOMPOutboundJournal::FFrame& Frame)
+{
+	// Requesting completion makes the server receipt the frame, which is what trims it from the journal.
+	// Drain already rate limits and tracks these frames as in flight, so they bypass the outbound scheduler;
+	// a queued copy would outlive a dropped connection and be sent again alongside the journal's own resend.
+	// Sequences restart when the journal is enabled again, so the receipt is tied to this journal as well.
+	StompClient->Send(Frame.Destination, Frame.Body, Frame.Header,
+		FStompRequestCompleted::CreateSP(this, &FSTOMPClientCore::HandleJournalReceipt, TWeakPtr<FSTOMPOutboundJournal>(OutboundJournal), Frame.Sequence));
+}
+
+void FSTOMPClientCore::HandleJournalReceipt(bool bSuccess, const FString& Error, TWeakPtr<FSTOMPOutboundJournal> Journal, uint64 Sequence)
+{
+	// A late receipt for a journal that has since been disabled or replaced says nothing about the current one
+	if (!OutboundJournal.IsValid() || Journal.Pin() != OutboundJournal)
+	{
+		return;
+	}
+
+	if (bSuccess)
+	{
+		OutboundJournal->Acknowledge(Sequence);
+	}
+	else
+	{
+		// Same rule as a dropped connection: a failure once the connection is gone is a transport failure and
+		// the frame is resent after reconnecting, however often that happens. While still connected it means
+		// the server refused the frame, which sending it again would not change, so it is dropped at once.
+		const bool bTransportFailure = !StompClient.IsValid() || !StompClient->IsConnected();
+		if (bTransportFailure)
+		{
+			OutboundJournal->Requeue(Sequence);
+			OnQueuedWorkChanged.ExecuteIfBound();
+			return;
+		}
+		OutboundJournal->Discard(Sequence);
+	}
+
+	FStompRequestCompleted CompletionCallback;
+	if (JournalCallbacks.RemoveAndCopyValue(Sequence, CompletionCallback))
+	{
+		CompletionCallback.ExecuteIfBound(bSuccess, Error);
+	}
+}
+
+void FSTOMPClientCore::FailJournalCallbacks(const TArray<uint64>& Sequences, const FString& Error)
+{
+	for (uint64 Sequence : Sequences)
+	{
+		FStompRequestCompleted CompletionCallback;
+		if (JournalCallbacks.RemoveAndCopyValue(Sequence, CompletionCallback))
+		{
+			CompletionCallback.ExecuteIfBound(false, Error);
+		}
+	}
+}
+
+bool FSTOMPClientCore::StartCapture(const FString& CapturePath)
+{
+	StopCapture();
+
+	TSharedPtr<FSTOMPTrafficCapture> Capture = MakeShared<FSTOMPTrafficCapture>(CapturePath);
+	if (!Capture->Open())
+	{
+		return false;
+	}
+
+	TrafficCapture = Capture;
+	UpdatePeriodicFlush();
+	return true;
+}
+
+void FSTOMPClientCore::StopCapture()
+{
+	TrafficCapture.Reset();
+	UpdatePeriodicFlush();
+}
+
+bool FSTOMPClientCore::ReplayCapture(const FString& CapturePath, float Speed, const FStompRequestCompleted& CompletionCallback)
+{
+	StopReplay();
+
+	TArray<FSTOMPTrafficCapture::FFrame> Frames;
+	if (!FSTOMPTrafficCapture::Load(CapturePath, Frames))
+	{
+		CompletionCallback.ExecuteIfBound(false, TEXT("Could not read traffic capture"));
+		return false;
+	}
+
+	TrafficReplay = MakeShared<FSTOMPTrafficReplay>(MoveTemp(Frames), Speed);
+	ReplayCompletionCallback = CompletionCallback;
+	MessagesDispatched = 0;
+	MessageObjectsCreated = 0;
+	if (TrafficReplay->IsMaxSpeed())
+	{
+		StepReplay(0.f);
+	}
+	OnQueuedWorkChanged.ExecuteIfBound();
+	return true;
+}
+
+void FSTOMPClientCore::StopReplay()
+{
+	if (TrafficReplay.IsValid())
+	{
+		FinishReplay(false, TEXT("Replay stopped"));
+	}
+}
+
+void FSTOMPClientCore::SetRecycleMessages(bool bNewRecycleMessages)
+{
+	bRecycleMessages = bNewRecycleMessages;
+	if (!bRecycleMessages)
+	{
+		for (USTOMPWebSocketMessage* Pooled : MessagePool)
+		{
+			Pooled->ConditionalBeginDestroy();
+		}
+		MessagePool.Empty();
+	}
+}
+
+bool FSTOMPClientCore::HasQueuedWork() const
+{
+	if (TrafficReplay.IsValid() || OutboundScheduler.HasQueued())
+	{
+		return true;
+	}
+	return OutboundJournal.IsValid() && OutboundJournal->HasPending() && StompClient.IsValid() && StompClient->IsConnected();
+}
+
+void FSTOMPClientCore::Tick(float DeltaTime)
+{
+	DrainOutboundJournal();
+	OutboundScheduler.Pump();
+	StepReplay(DeltaTime);
+}
+
+void FSTOMPClientCore::AddReferencedObjects(FReferenceCollector& Collector)
+{
+	Collector.AddReferencedObjects(MessagePool);
+}
+
+void FSTOMPClientCore::Shutdown()
+{
+	OnQueuedWorkChanged.Unbind();
+	JournalCallbacks.Reset();
+	OutboundJournal.Reset();
+	TrafficCapture.Reset();
+	TrafficReplay.Reset();
+	ReplayCompletionCallback.Unbind();
+	Subscriptions.Reset();
+	MessagePool.Reset();
+	FSTOMPSharedTicker::Get().Remove(PeriodicFlushHandle);
+}
+
+void FSTOMPClientCore::HandleMessage(const IStompMessage& Message, FSTOMPMessageEvent EventCallback)
+{
+	if (TrafficCapture.IsValid())
+	{
+		TrafficCapture->RecordMessage(Message);
+	}
+	DispatchMessage(Message, EventCallback);
+}
+
+void FSTOMPClientCore::DispatchMessage(const IStompMessage& Message, const FSTOMPMessageEvent& EventCallback)
+{
+	USTOMPWebSocketMessage* msg = bRecycleMessages && MessagePool.Num() > 0 ? MessagePool.Pop(EAllowShrinking::No).Get() : nullptr;
+	if (!msg)
+	{
+		msg = NewObject<USTOMPWebSocketMessage>(Owner);
+		++MessageObjectsCreated;
+	}
+	++MessagesDispatched;
+
+	msg->MyMessage = &Message;
+	msg->TrafficCapture = TrafficCapture;
+	EventCallback.ExecuteIfBound(msg);
+
+	// Retained messages now own a copy of the frame and belong to the handler
+	if (!msg->Release())
+	{
+		return;
+	}
+
+	if (bRecycleMessages)
+	{
+		MessagePool.Push(msg);
+	}
+	else
+	{
+		msg->ConditionalBeginDestroy();
+	}
+}
+
+void FSTOMPClientCore::DispatchReplayedFrame(const FSTOMPTrafficCapture::FFrame& Frame, const FString& SubscribedDestination)
+{
+	// Handlers are free to unsubscribe while the frame is being delivered
+	TArray<TPair<FString, FSTOMPMessageEvent>, TInlineAllocator<4>> Targets;
+	for (const TPair<FString, FSubscription>& Pair : Subscriptions)
+	{
+		if (Pair.Value.Destination == SubscribedDestination)
+		{
+			Targets.Emplace(Pair.Key, Pair.Value.EventCallback);
+		}
+	}
+
+	for (const TPair<FString, FSTOMPMessageEvent>& Target : Targets)
+	{
+		FSTOMPReplayMessage Message(Frame, Target.Key);
+		DispatchMessage(Message, Target.Value);
+	}
+}
+
+void FSTOMPClientCore::StepReplay(float DeltaTime)
+{
+	// Hold a reference in case a handler stops or restarts the replay
+	TSharedPtr<FSTOMPTrafficReplay> Replay = TrafficReplay;
+	if (!Replay.IsValid())
+	{
+		return;
+	}
+
+	const bool bFinished = Replay->Step(DeltaTime, [this](const FSTOMPTrafficCapture::FFrame& Frame, const FString& SubscribedDestination)
+	{
+		DispatchReplayedFrame(Frame, SubscribedDestination);
+	});
+
+	if (bFinished && Replay == TrafficReplay)
+	{
+		FinishReplay(true, FString());
+	}
+}
+
+void FSTOMPClientCore::FinishReplay(bool bSuccess, const FString& Error)
+{
+	UE_LOG(LogSTOMPWebSockets, Log, TEXT("Replay %s: %s, %d message objects created for %d deliveries"), bSuccess ? TEXT("finished") : TEXT("stopped"),
+		*TrafficReplay->GetSummary(), MessageObjectsCreated, MessagesDispatched);
+	TrafficReplay.Reset();
+	FStompRequestCompleted CompletionCallback = ReplayCompletionCallback;
+	ReplayCompletionCallback.Unbind();
+	CompletionCallback.ExecuteIfBound(bSuccess, Error);
+	OnQueuedWorkChanged.ExecuteIfBound();
+}
+
+void FSTOMPClientCore::UpdatePeriodicFlush()
+{
+	const bool bNeedsFlush = OutboundJournal.IsValid() || TrafficCapture.IsValid();
+	if (bNeedsFlush && !PeriodicFlushHandle.IsValid())
+	{
+		PeriodicFlushHandle = FSTOMPSharedTicker::Get().Add(FTickerDelegate::CreateSP(this, &FSTOMPClientCore::FlushPeriodic), FSTOMPSharedTicker::FlushInterval);
+	}
+	else if (!bNeedsFlush)
+	{
+		FSTOMPSharedTicker::Get().Remove(PeriodicFlushHandle);
+	}
+}
+
+bool FSTOMPClientCore::FlushPeriodic(float DeltaTime)
+{
+	if (OutboundJournal.IsValid())
+	{
+		OutboundJournal->Flush();
+	}
+	if (TrafficCapture.IsValid())
+	{
+		TrafficCapture->Flush();
+	}
+	return true;
+}
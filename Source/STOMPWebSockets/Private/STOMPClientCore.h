@@ -0,0 +1,131 @@
+// Copyright 2020 Richard W. Van Tassel. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "IStompClient.h"
+#include "STOMPOutboundJournal.h"
+#include "STOMPOutboundScheduler.h"
+#include "STOMPTrafficCapture.h"
+
+class IStompMessage;
+class USTOMPWebSocketMessage;
+
+DECLARE_DELEGATE_OneParam(FSTOMPMessageEvent, USTOMPWebSocketMessage*);
+
+/**
+ * Client behaviour shared by USTOMPWebSocketClient and USTOMPWebSocketClientObject.
+ *
+ * Owns subscriptions and inbound message dispatch, the outbound scheduler and journal,
+ * and traffic capture and replay. The UObjects adapt their Blueprint delegates to this
+ * class and decide how queued work is ticked; everything else lives here once.
+ */
+class FSTOMPClientCore : public TSharedFromThis<FSTOMPClientCore>
+{
+public:
+	/** @param InOwner Outer of the message objects handed to subscription callbacks. Owns the core. */
+	explicit FSTOMPClientCore(UObject* InOwner);
+	~FSTOMPClientCore();
+
+	FSTOMPClientCore(const FSTOMPClientCore&) = delete;
+	FSTOMPClientCore& operator=(const FSTOMPClientCore&) = delete;
+
+	/** Called whenever HasQueuedWork may have changed, so the owner can start or stop ticking. */
+	FSimpleDelegate OnQueuedWorkChanged;
+
+	/** Use a newly built client. Subscriptions made on the previous one are dropped; replay-only ones are kept. */
+	void SetStompClient(const TSharedPtr<IStompClient>& InStompClient);
+
+	/** Call when the client has connected. */
+	void HandleConnected();
+
+	/** Call when the connection has closed or could not be established. */
+	void HandleDisconnected();
+
+	/** Subscribe on the server. Fails the completion callback and returns an empty id without a client. */
+	FString Subscribe(const FString& Destination, const FSTOMPMessageEvent& EventCallback, const FStompRequestCompleted& CompletionCallback);
+
+	/** Subscribe to replayed captures only. Needs no client and sends nothing to the server. */
+	FString SubscribeForReplay(const FString& Destination, const FSTOMPMessageEvent& EventCallback);
+
+	void Unsubscribe(const FString& Subscription, const FStompRequestCompleted& CompletionCallback);
+	void Send(const FString& Destination, const TArray<uint8>& Body, const TMap<FName, FString>& Header,
+		const FStompRequestCompleted& CompletionCallback, ESTOMPTrafficLane Lane);
+
+	void SetDestinationLane(const FString& Destination, ESTOMPTrafficLane Lane);
+	void SetOutboundSchedule(int32 InteractiveWeight, int32 BulkWeight, int32 BulkBytesPerTick);
+
+	bool EnableOutboundJournal(const FString& JournalPath, int64 MaxBytes, ESTOMPJournalOverflowPolicy OverflowPolicy, float DrainRate);
+	void DisableOutboundJournal();
+	int32 GetJournaledFrameCount() const;
+
+	bool StartCapture(const FString& CapturePath);
+	void StopCapture();
+
+	bool ReplayCapture(const FString& CapturePath, float Speed, const FStompRequestCompleted& CompletionCallback);
+	void StopReplay();
+
+	void SetRecycleMessages(bool bNewRecycleMessages);
+	bool GetRecycleMessages() const { return bRecycleMessages; }
+
+	/** Whether Tick has anything to do. */
+	bool HasQueuedWork() const;
+
+	/** Drain the journal and scheduler and advance a replay. */
+	void Tick(float DeltaTime);
+
+	/** Report pooled message objects to the owner's garbage collection. */
+	void AddReferencedObjects(FReferenceCollector& Collector);
+
+	/**
+	 * Close the journal and capture and drop subscriptions, replay and pending callbacks without running any of them.
+	 * For owners being garbage collected, where calling back into Blueprint is not safe.
+	 */
+	void Shutdown();
+
+private:
+	//Outbound journal plumbing
+	void DrainOutboundJournal();
+	void SendJournaledFrame(const FSTOMPOutboundJournal::FFrame& Frame);
+	void HandleJournalReceipt(bool bSuccess, const FString& Error, TWeakPtr<FSTOMPOutboundJournal> Journal, uint64 Sequence);
+	void FailJournalCallbacks(const TArray<uint64>& Sequences, const FString& Error);
+
+	//Inbound dispatch shared by live subscriptions and replayed captures
+	void HandleMessage(const IStompMessage& Message, FSTOMPMessageEvent EventCallback);
+	void DispatchMessage(const IStompMessage& Message, const FSTOMPMessageEvent& EventCallback);
+	void DispatchReplayedFrame(const FSTOMPTrafficCapture::FFrame& Frame, const FString& SubscribedDestination);
+	void StepReplay(float DeltaTime);
+	void FinishReplay(bool bSuccess, const FString& Error);
+
+	//Periodic work runs on the ticker shared by all clients
+	void UpdatePeriodicFlush();
+	bool FlushPeriodic(float DeltaTime);
+
+	UObject* Owner;
+	TSharedPtr<IStompClient> StompClient;
+
+	FSTOMPOutboundScheduler OutboundScheduler;
+	TSharedPtr<FSTOMPOutboundJournal> OutboundJournal;
+	TMap<uint64, FStompRequestCompleted> JournalCallbacks;
+
+	struct FSubscription
+	{
+		FString Destination;
+		FSTOMPMessageEvent EventCallback;
+		bool bReplayOnly = false;
+	};
+	TMap<FString, FSubscription> Subscriptions;
+
+	TSharedPtr<FSTOMPTrafficCapture> TrafficCapture;
+	TSharedPtr<FSTOMPTrafficReplay> TrafficReplay;
+	FStompRequestCompleted ReplayCompletionCallback;
+
+	bool bRecycleMessages;
+
+	//Message objects kept for reuse while bRecycleMessages is set
+	TArray<TObjectPtr<USTOMPWebSocketMessage>> MessagePool;
+	int32 MessagesDispatched;
+	int32 MessageObjectsCreated;
+
+	FDelegateHandle PeriodicFlushHandle;
+};
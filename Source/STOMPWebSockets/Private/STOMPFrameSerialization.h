@@ -0,0 +1,54 @@
+// Copyright 2020 Richard W. Van Tassel. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Serialization/Archive.h"
+
+/**
+ * Serialize a STOMP header map.
+ * Keys are written as plain strings so the result does not depend on the archive's FName handling.
+ */
+inline void SerializeStompHeader(FArchive& Ar, TMap<FName, FString>& Header)
+{
+	int32 Count = Header.Num();
+	Ar << Count;
+
+	if (Ar.IsLoading())
+	{
+		Header.Reset();
+
+		// Count comes from the file, so check it against the bytes left before reserving for it.
+		// Every entry takes at least the two string lengths.
+		const int64 MinEntryBytes = sizeof(int32) * 2;
+		const int64 TotalSize = Ar.TotalSize();
+		const bool bKnownSize = TotalSize >= 0;
+		if (Count < 0 || Ar.IsError() || (bKnownSize && Count > (TotalSize - Ar.Tell()) / MinEntryBytes))
+		{
+			Ar.SetError();
+			return;
+		}
+
+		if (bKnownSize)
+		{
+			Header.Reserve(Count);
+		}
+		for (int32 Index = 0; Index < Count && !Ar.IsError(); ++Index)
+		{
+			FString Key;
+			FString Value;
+			Ar << Key;
+			Ar << Value;
+			Header.Add(FName(*Key), MoveTemp(Value));
+		}
+	}
+	else
+	{
+		for (TPair<FName, FString>& Pair : Header)
+		{
+			FString Key = Pair.Key.ToString();
+			Ar << Key;
+			Ar << Pair.Value;
+		}
+	}
+}
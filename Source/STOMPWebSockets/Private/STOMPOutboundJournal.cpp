@@ -0,0 +1,545 @@
+// Copyright 2020 Richard W. Van Tassel. All Rights Reserved.
+
+#include "STOMPOutboundJournal.h"
+#include "STOMPWebSockets.h"
+#include "STOMPFrameSerialization.h"
+#include "Algo/BinarySearch.h"
+#include "HAL/PlatformFileManager.h"
+#include "HAL/PlatformTime.h"
+#include "Misc/Crc.h"
+#include "Misc/Paths.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+namespace STOMPOutboundJournal
+{
+	/** "SWJ1" */
+	static const uint32 FileMagic = 0x314A5753;
+	static const uint32 FileVersion = 1;
+	static const int64 FileHeaderSize = sizeof(uint32) * 2;
+
+	/** Payload size, kind, sequence and payload CRC. */
+	static const int64 RecordHeaderSize = sizeof(uint32) + sizeof(uint8) + sizeof(uint64) + sizeof(uint32);
+
+	/** Dead bytes tolerated before the file is rewritten. */
+	static const int64 CompactThresholdBytes = 1024 * 1024;
+}
+
+FSTOMPOutboundJournal::FSTOMPOutboundJournal(const FString& InPath, int64 InMaxBytes, ESTOMPJournalOverflowPolicy InOverflowPolicy, float InDrainRate)
+	: Path(InPath)
+	, MaxBytes(InMaxBytes)
+	, OverflowPolicy(InOverflowPolicy)
+	, DrainRate(InDrainRate)
+	, DrainTokens(FMath::Max(InDrainRate, 1.f))
+	, LastDrainSeconds(FPlatformTime::Seconds())
+	, Writer(nullptr)
+	, NextSequence(1)
+	, FileBytes(0)
+	, LiveBytes(0)
+{
+}
+
+FSTOMPOutboundJournal::~FSTOMPOutboundJournal()
+{
+	Close();
+}
+
+bool FSTOMPOutboundJournal::Open()
+{
+	if (IsOpen())
+	{
+		return true;
+	}
+
+	FPlatformFileManager::Get().GetPlatformFile().CreateDirectoryTree(*FPaths::GetPath(Path));
+
+	// A torn tail or a foreign file is rewritten with whatever could be recovered
+	const bool bOpened = LoadExisting() ? OpenWriter(FileBytes > 0) : Compact();
+	if (!bOpened)
+	{
+		UE_LOG(LogSTOMPWebSockets, Error, TEXT("Could not open outbound journal %s"), *Path);
+		return false;
+	}
+
+	if (Records.Num() > 0)
+	{
+		UE_LOG(LogSTOMPWebSockets, Log, TEXT("Recovered %d unreceipted frames from outbound journal %s"), Records.Num(), *Path);
+	}
+	return true;
+}
+
+void FSTOMPOutboundJournal::Close()
+{
+	ReleaseMapping();
+
+	if (Writer)
+	{
+		Writer->Flush(true);
+		delete Writer;
+		Writer = nullptr;
+	}
+}
+
+void FSTOMPOutboundJournal::Flush()
+{
+	// Runs periodically on the game thread, so leave syncing to the device to the OS
+	if (Writer)
+	{
+		Writer->Flush();
+	}
+}
+
+bool FSTOMPOutboundJournal::LoadExisting()
+{
+	using namespace STOMPOutboundJournal;
+
+	Records.Reset();
+	LiveBytes = 0;
+	FileBytes = 0;
+
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	const int64 Size = PlatformFile.FileSize(*Path);
+	if (Size < 0)
+	{
+		return true;
+	}
+
+	TArray<uint8> Scratch;
+	TArrayView<const uint8> View;
+	if (Size < FileHeaderSize || !ViewFile(0, Size, Scratch, View))
+	{
+		return false;
+	}
+
+	{
+		FMemoryReaderView Ar(View.Slice(0, FileHeaderSize));
+		uint32 Magic = 0;
+		uint32 Version = 0;
+		Ar << Magic;
+		Ar << Version;
+		if (Magic != FileMagic || Version != FileVersion)
+		{
+			UE_LOG(LogSTOMPWebSockets, Warning, TEXT("Discarding unrecognized outbound journal %s"), *Path);
+			return false;
+		}
+	}
+
+	int64 Offset = FileHeaderSize;
+	while (Offset + RecordHeaderSize <= Size)
+	{
+		FMemoryReaderView Ar(View.Slice(Offset, RecordHeaderSize));
+		uint32 PayloadSize = 0;
+		uint8 Kind = 0;
+		uint64 Sequence = 0;
+		uint32 Crc = 0;
+		Ar << PayloadSize;
+		Ar << Kind;
+		Ar << Sequence;
+		Ar << Crc;
+
+		const int64 RecordSize = RecordHeaderSize + PayloadSize;
+		if (Offset + RecordSize > Size
+			|| FCrc::MemCrc32(View.GetData() + Offset + RecordHeaderSize, PayloadSize) != Crc)
+		{
+			break;
+		}
+
+		if (Kind == (uint8)ERecordKind::Frame)
+		{
+			Records.Add({ Sequence, Offset, RecordSize, ERecordState::Pending });
+			LiveBytes += RecordSize;
+			NextSequence = FMath::Max(NextSequence, Sequence + 1);
+		}
+		else if (Kind == (uint8)ERecordKind::Receipt)
+		{
+			const int32 Index = FindRecord(Sequence);
+			if (Index != INDEX_NONE)
+			{
+				LiveBytes -= Records[Index].Size;
+				Records.RemoveAt(Index);
+			}
+		}
+		Offset += RecordSize;
+	}
+
+	FileBytes = Size;
+	if (Offset != Size)
+	{
+		UE_LOG(LogSTOMPWebSockets, Warning, TEXT("Outbound journal %s has a damaged tail, truncating after %lld bytes"), *Path, Offset);
+		return false;
+	}
+	return true;
+}
+
+bool FSTOMPOutboundJournal::OpenWriter(bool bAppend)
+{
+	using namespace STOMPOutboundJournal;
+
+	Writer = FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*Path, bAppend, true);
+	if (!Writer)
+	{
+		return false;
+	}
+
+	if (!bAppend)
+	{
+		TArray<uint8> Header;
+		FMemoryWriter Ar(Header);
+		uint32 Magic = FileMagic;
+		uint32 Version = FileVersion;
+		Ar << Magic;
+		Ar << Version;
+		if (!Writer->Write(Header.GetData(), Header.Num()))
+		{
+			delete Writer;
+			Writer = nullptr;
+			return false;
+		}
+		FileBytes = FileHeaderSize;
+	}
+	return true;
+}
+
+bool FSTOMPOutboundJournal::WriteRecord(ERecordKind Kind, uint64 Sequence, const TArray<uint8>& Payload, int64& OutOffset, int64& OutSize)
+{
+	using namespace STOMPOutboundJournal;
+
+	if (!Writer)
+	{
+		return false;
+	}
+
+	TArray<uint8> RecordHeader;
+	RecordHeader.Reserve(RecordHeaderSize);
+	FMemoryWriter Ar(RecordHeader);
+	uint32 PayloadSize = Payload.Num();
+	uint8 KindByte = (uint8)Kind;
+	uint32 Crc = FCrc::MemCrc32(Payload.GetData(), Payload.Num());
+	Ar << PayloadSize;
+	Ar << KindByte;
+	Ar << Sequence;
+	Ar << Crc;
+
+	if (!Writer->Write(RecordHeader.GetData(), RecordHeader.Num())
+		|| (Payload.Num() > 0 && !Writer->Write(Payload.GetData(), Payload.Num())))
+	{
+		UE_LOG(LogSTOMPWebSockets, Error, TEXT("Failed to write to outbound journal %s"), *Path);
+		return false;
+	}
+
+	OutOffset = FileBytes;
+	OutSize = RecordHeaderSize + Payload.Num();
+	FileBytes += OutSize;
+	return true;
+}
+
+bool FSTOMPOutboundJournal::Append(const FString& Destination, const TArray<uint8>& Body, const TMap<FName, FString>& Header, uint64& OutSequence, TArray<uint64>& OutEvicted)
+{
+	using namespace STOMPOutboundJournal;
+
+	TArray<uint8> Payload;
+	Payload.Reserve(Body.Num() + Destination.Len() + 64);
+	FMemoryWriter Ar(Payload);
+	FString DestinationCopy = Destination;
+	TMap<FName, FString> HeaderCopy = Header;
+	int32 BodyNum = Body.Num();
+	Ar << DestinationCopy;
+	SerializeStompHeader(Ar, HeaderCopy);
+	Ar << BodyNum;
+	Ar.Serialize(const_cast<uint8*>(Body.GetData()), BodyNum);
+
+	const int64 RecordSize = RecordHeaderSize + Payload.Num();
+	if (RecordSize > MaxBytes)
+	{
+		return false;
+	}
+
+	while (LiveBytes + RecordSize > MaxBytes)
+	{
+		if (OverflowPolicy == ESTOMPJournalOverflowPolicy::RejectNew || Records.Num() == 0)
+		{
+			return false;
+		}
+
+		UE_LOG(LogSTOMPWebSockets, Warning, TEXT("Outbound journal %s is full, evicting frame %llu"), *Path, Records[0].Sequence);
+		OutEvicted.Add(Records[0].Sequence);
+		RemoveRecord(0);
+	}
+
+	const uint64 Sequence = NextSequence;
+	int64 Offset = 0;
+	int64 Size = 0;
+	if (!WriteRecord(ERecordKind::Frame, Sequence, Payload, Offset, Size))
+	{
+		return false;
+	}
+
+	++NextSequence;
+	Records.Add({ Sequence, Offset, Size, ERecordState::Pending });
+	LiveBytes += Size;
+	OutSequence = Sequence;
+
+	FFrame& Unsent = UnsentFrames.Add(Sequence);
+	Unsent.Sequence = Sequence;
+	Unsent.Destination = Destination;
+	Unsent.Header = Header;
+	Unsent.Body = Body;
+
+	MaybeCompact();
+	return true;
+}
+
+void FSTOMPOutboundJournal::Acknowledge(uint64 Sequence)
+{
+	const int32 Index = FindRecord(Sequence);
+	if (Index != INDEX_NONE)
+	{
+		RemoveRecord(Index);
+		MaybeCompact();
+	}
+}
+
+void FSTOMPOutboundJournal::Discard(uint64 Sequence)
+{
+	const int32 Index = FindRecord(Sequence);
+	if (Index != INDEX_NONE)
+	{
+		UE_LOG(LogSTOMPWebSockets, Warning, TEXT("Dropping refused frame %llu from outbound journal %s"), Sequence, *Path);
+		RemoveRecord(Index);
+		MaybeCompact();
+	}
+}
+
+void FSTOMPOutboundJournal::Requeue(uint64 Sequence)
+{
+	const int32 Index = FindRecord(Sequence);
+	if (Index != INDEX_NONE)
+	{
+		Records[Index].State = ERecordState::Pending;
+	}
+}
+
+void FSTOMPOutboundJournal::RequeueInFlight()
+{
+	for (FRecord& Record : Records)
+	{
+		Record.State = ERecordState::Pending;
+	}
+}
+
+int32 FSTOMPOutboundJournal::Drain(TFunctionRef<void(const FFrame&)> SendFrame, TArray<uint64>& OutDropped)
+{
+	const double Now = FPlatformTime::Seconds();
+	const bool bRateLimited = DrainRate > 0.f;
+	if (bRateLimited)
+	{
+		DrainTokens = FMath::Min(DrainTokens + (float)(Now - LastDrainSeconds) * DrainRate, FMath::Max(DrainRate, 1.f));
+	}
+	LastDrainSeconds = Now;
+
+	// Collect the batch first so SendFrame may safely call back into the journal
+	TArray<FFrame> Batch;
+	for (int32 Index = 0; Index < Records.Num(); ++Index)
+	{
+		if (bRateLimited && DrainTokens < 1.f)
+		{
+			break;
+		}
+
+		if (Records[Index].State != ERecordState::Pending)
+		{
+			continue;
+		}
+
+		if (FFrame* Unsent = UnsentFrames.Find(Records[Index].Sequence))
+		{
+			Batch.Add(MoveTemp(*Unsent));
+			UnsentFrames.Remove(Records[Index].Sequence);
+		}
+		else if (!ReadFrame(Records[Index], Batch.AddDefaulted_GetRef()))
+		{
+			UE_LOG(LogSTOMPWebSockets, Error, TEXT("Dropping unreadable frame %llu from outbound journal %s"), Records[Index].Sequence, *Path);
+			Batch.Pop(EAllowShrinking::No);
+			OutDropped.Add(Records[Index].Sequence);
+			RemoveRecord(Index--);
+			continue;
+		}
+
+		Records[Index].State = ERecordState::InFlight;
+		if (bRateLimited)
+		{
+			DrainTokens -= 1.f;
+		}
+	}
+
+	for (const FFrame& Frame : Batch)
+	{
+		SendFrame(Frame);
+	}
+	return Batch.Num();
+}
+
+bool FSTOMPOutboundJournal::HasPending() const
+{
+	return Records.ContainsByPredicate([](const FRecord& Record) { return Record.State == ERecordState::Pending; });
+}
+
+bool FSTOMPOutboundJournal::ReadFrame(const FRecord& Record, FFrame& OutFrame)
+{
+	using namespace STOMPOutboundJournal;
+
+	TArray<uint8> Scratch;
+	TArrayView<const uint8> View;
+	if (!ViewFile(Record.Offset + RecordHeaderSize, Record.Size - RecordHeaderSize, Scratch, View))
+	{
+		return false;
+	}
+
+	FMemoryReaderView Ar(View);
+	int32 BodyNum = 0;
+	Ar << OutFrame.Destination;
+	SerializeStompHeader(Ar, OutFrame.Header);
+	Ar << BodyNum;
+	if (Ar.IsError() || BodyNum < 0 || BodyNum > Ar.TotalSize() - Ar.Tell())
+	{
+		return false;
+	}
+
+	OutFrame.Sequence = Record.Sequence;
+	OutFrame.Body.SetNumUninitialized(BodyNum);
+	Ar.Serialize(OutFrame.Body.GetData(), BodyNum);
+	return !Ar.IsError();
+}
+
+bool FSTOMPOutboundJournal::ViewFile(int64 Offset, int64 Size, TArray<uint8>& Scratch, TArrayView<const uint8>& OutView)
+{
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+
+	// The mapping covers the file as it was when mapped, so appends since then need a fresh one
+	if (!MappedRegion.IsValid() || Offset + Size > MappedRegion->GetMappedSize())
+	{
+		ReleaseMapping();
+		if (Writer)
+		{
+			Writer->Flush();
+		}
+
+		auto Result = PlatformFile.OpenMappedEx(*Path, EOpenReadFlags::AllowWrite);
+		if (Result.HasValue())
+		{
+			MappedFile = Result.StealValue();
+			MappedRegion.Reset(MappedFile->MapRegion(0, MappedFile->GetFileSize()));
+		}
+	}
+
+	if (MappedRegion.IsValid() && Offset + Size <= MappedRegion->GetMappedSize())
+	{
+		OutView = TArrayView<const uint8>(MappedRegion->GetMappedPtr() + Offset, Size);
+		return true;
+	}
+
+	// Platforms without mapped file support fall back to a plain read
+	TUniquePtr<IFileHandle> Reader(PlatformFile.OpenRead(*Path, true));
+	if (!Reader.IsValid() || !Reader->Seek(Offset))
+	{
+		return false;
+	}
+
+	Scratch.SetNumUninitialized(Size);
+	if (!Reader->Read(Scratch.GetData(), Size))
+	{
+		return false;
+	}
+	OutView = Scratch;
+	return true;
+}
+
+void FSTOMPOutboundJournal::ReleaseMapping()
+{
+	MappedRegion.Reset();
+	MappedFile.Reset();
+}
+
+int32 FSTOMPOutboundJournal::FindRecord(uint64 Sequence) const
+{
+	const int32 Index = Algo::LowerBoundBy(Records, Sequence, &FRecord::Sequence);
+	return Records.IsValidIndex(Index) && Records[Index].Sequence == Sequence ? Index : INDEX_NONE;
+}
+
+void FSTOMPOutboundJournal::RemoveRecord(int32 Index)
+{
+	int64 Offset = 0;
+	int64 Size = 0;
+	WriteRecord(ERecordKind::Receipt, Records[Index].Sequence, TArray<uint8>(), Offset, Size);
+
+	LiveBytes -= Records[Index].Size;
+	UnsentFrames.Remove(Records[Index].Sequence);
+	Records.RemoveAt(Index);
+}
+
+void FSTOMPOutboundJournal::MaybeCompact()
+{
+	using namespace STOMPOutboundJournal;
+
+	const int64 DeadBytes = FileBytes - FileHeaderSize - LiveBytes;
+	if (DeadBytes > CompactThresholdBytes && DeadBytes > LiveBytes)
+	{
+		Compact();
+	}
+}
+
+bool FSTOMPOutboundJournal::Compact()
+{
+	using namespace STOMPOutboundJournal;
+
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	const FString TempPath = Path + TEXT(".compact");
+
+	{
+		TUniquePtr<IFileHandle> Temp(PlatformFile.OpenWrite(*TempPath));
+		if (!Temp.IsValid())
+		{
+			return false;
+		}
+
+		TArray<uint8> Header;
+		FMemoryWriter Ar(Header);
+		uint32 Magic = FileMagic;
+		uint32 Version = FileVersion;
+		Ar << Magic;
+		Ar << Version;
+		bool bWritten = Temp->Write(Header.GetData(), Header.Num());
+
+		TArray<uint8> Scratch;
+		for (int32 Index = 0; bWritten && Index < Records.Num(); ++Index)
+		{
+			TArrayView<const uint8> View;
+			bWritten = ViewFile(Records[Index].Offset, Records[Index].Size, Scratch, View)
+				&& Temp->Write(View.GetData(), View.Num());
+		}
+
+		if (!bWritten)
+		{
+			Temp.Reset();
+			PlatformFile.DeleteFile(*TempPath);
+			UE_LOG(LogSTOMPWebSockets, Error, TEXT("Failed to compact outbound journal %s"), *Path);
+			return Writer != nullptr;
+		}
+	}
+
+	Close();
+	PlatformFile.DeleteFile(*Path);
+	if (!PlatformFile.MoveFile(*Path, *TempPath))
+	{
+		UE_LOG(LogSTOMPWebSockets, Error, TEXT("Failed to replace outbound journal %s with its compacted copy"), *Path);
+		return false;
+	}
+
+	FileBytes = FileHeaderSize;
+	for (FRecord& Record : Records)
+	{
+		Record.Offset = FileBytes;
+		FileBytes += Record.Size;
+	}
+	return OpenWriter(true);
+}
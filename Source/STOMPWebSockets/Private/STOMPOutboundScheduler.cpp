@@ -0,0 +1,161 @@
+// Copyright 2020 Richard W. Van Tassel. All Rights Reserved.
+
+#include "STOMPOutboundScheduler.h"
+
+namespace STOMPOutboundScheduler
+{
+	/** Bytes a lane of weight 1 may send per drain round, about one network packet. */
+	static const int64 Quantum = 1500;
+}
+
+FSTOMPOutboundScheduler::FSTOMPOutboundScheduler()
+	: BulkBytesPerTick(65536)
+	, BulkBytesThisTick(0)
+{
+	Interactive.Weight = 4;
+	Bulk.Weight = 1;
+}
+
+ESTOMPTrafficLane FSTOMPOutboundScheduler::ResolveLane(ESTOMPTrafficLane Lane, const FString& Destination) const
+{
+	if (Lane != ESTOMPTrafficLane::Default)
+	{
+		return Lane;
+	}
+
+	const ESTOMPTrafficLane* DestinationLane = DestinationLanes.Find(Destination);
+	return DestinationLane ? *DestinationLane : ESTOMPTrafficLane::Interactive;
+}
+
+void FSTOMPOutboundScheduler::SetDestinationLane(const FString& Destination, ESTOMPTrafficLane Lane)
+{
+	if (Lane == ESTOMPTrafficLane::Default)
+	{
+		DestinationLanes.Remove(Destination);
+	}
+	else
+	{
+		DestinationLanes.Add(Destination, Lane);
+	}
+}
+
+void FSTOMPOutboundScheduler::Configure(int32 InteractiveWeight, int32 BulkWeight, int32 InBulkBytesPerTick)
+{
+	Interactive.Weight = FMath::Max(InteractiveWeight, 1);
+	Bulk.Weight = FMath::Max(BulkWeight, 1);
+	BulkBytesPerTick = FMath::Max(InBulkBytesPerTick, 1);
+}
+
+bool FSTOMPOutboundScheduler::TryAdmit(ESTOMPTrafficLane Lane, int32 Bytes)
+{
+	switch (Lane)
+	{
+	case ESTOMPTrafficLane::Bulk:
+		// Unlike a queued send, an immediate one must fit the budget, so an oversized frame waits its turn
+		if (HasQueued() || BulkBytesThisTick + Bytes > BulkBytesPerTick)
+		{
+			return false;
+		}
+		BulkBytesThisTick += Bytes;
+		return true;
+
+	case ESTOMPTrafficLane::Control:
+		return true;
+
+	default:
+		// Queued bulk work is owed its weighted share, so interactive sends queue behind it rather than overtake it
+		return !HasQueued();
+	}
+}
+
+void FSTOMPOutboundScheduler::Enqueue(ESTOMPTrafficLane Lane, int32 Bytes, TUniqueFunction<void()>&& Send)
+{
+	if (Lane == ESTOMPTrafficLane::Control)
+	{
+		Send();
+		return;
+	}
+
+	GetLane(Lane).Queue.Add({ Bytes, MoveTemp(Send) });
+}
+
+void FSTOMPOutboundScheduler::Pump()
+{
+	using namespace STOMPOutboundScheduler;
+
+	// The bulk budget covers everything sent since the previous Pump, immediate sends included
+	BulkBytesThisTick = 0;
+
+	// Deficit round robin: each round a lane earns Quantum * Weight bytes of credit and
+	// sends from its head while the credit covers it. Bulk stops once its budget is spent.
+	bool bBulkBlocked = false;
+	bool bWorking = true;
+	while (bWorking)
+	{
+		bWorking = false;
+		for (FLane* Lane : { &Interactive, &Bulk })
+		{
+			const bool bIsBulk = Lane == &Bulk;
+			if (Lane->IsEmpty() || (bIsBulk && bBulkBlocked))
+			{
+				continue;
+			}
+
+			bWorking = true;
+			Lane->Deficit += Quantum * Lane->Weight;
+			while (!Lane->IsEmpty() && Lane->Queue[Lane->Head].Bytes <= Lane->Deficit)
+			{
+				const int32 Bytes = Lane->Queue[Lane->Head].Bytes;
+				if (bIsBulk && !FitsBulkBudget(Bytes))
+				{
+					bBulkBlocked = true;
+					break;
+				}
+
+				// Sending may queue more work, so move the operation out before running it
+				TUniqueFunction<void()> Send = MoveTemp(Lane->Queue[Lane->Head++].Send);
+				Lane->Deficit -= Bytes;
+				if (bIsBulk)
+				{
+					BulkBytesThisTick += Bytes;
+				}
+				Send();
+			}
+		}
+	}
+
+	for (FLane* Lane : { &Interactive, &Bulk })
+	{
+		// An idle lane does not bank credit for later
+		if (Lane->IsEmpty())
+		{
+			Lane->Deficit = 0;
+		}
+		Compact(*Lane);
+	}
+}
+
+bool FSTOMPOutboundScheduler::HasQueued() const
+{
+	return !Interactive.IsEmpty() || !Bulk.IsEmpty();
+}
+
+FSTOMPOutboundScheduler::FLane& FSTOMPOutboundScheduler::GetLane(ESTOMPTrafficLane Lane)
+{
+	return Lane == ESTOMPTrafficLane::Bulk ? Bulk : Interactive;
+}
+
+bool FSTOMPOutboundScheduler::FitsBulkBudget(int32 Bytes) const
+{
+	// A frame larger than the whole budget goes out alone as the first bulk send of a Pump
+	return BulkBytesThisTick == 0 || BulkBytesThisTick + Bytes <= BulkBytesPerTick;
+}
+
+void FSTOMPOutboundScheduler::Compact(FLane& Lane)
+{
+	if (Lane.Head > 0)
+	{
+		Lane.Queue.RemoveAt(0, Lane.Head, EAllowShrinking::No);
+		Lane.Head = 0;
+	}
+}
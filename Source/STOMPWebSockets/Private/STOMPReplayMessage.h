@@ -0,0 +1,82 @@
+// Copyright 2020 Richard W. Van Tassel. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "IStompMessage.h"
+#include "STOMPTrafficCapture.h"
+
+/**
+ * A captured MESSAGE frame presented through the same interface as a live one.
+ * There is no server behind it, so Ack and Nack complete successfully without sending anything.
+ * The frame and subscription id are referenced, not copied, so both must outlive the message.
+ */
+class FSTOMPReplayMessage : public IStompMessage
+{
+public:
+	FSTOMPReplayMessage(const FSTOMPTrafficCapture::FFrame& InFrame, const FString& InSubscriptionId)
+		: Frame(InFrame)
+		, SubscriptionId(InSubscriptionId)
+	{ }
+
+	virtual const FStompHeader& GetHeader() const override
+	{
+		return Frame.Header;
+	}
+
+	virtual FString GetBodyAsString() const override
+	{
+		FUTF8ToTCHAR Convert((const ANSICHAR*)Frame.Body.GetData(), Frame.Body.Num());
+		return FString(Convert.Length(), Convert.Get());
+	}
+
+	virtual const uint8* GetRawBody() const override
+	{
+		return Frame.Body.GetData();
+	}
+
+	virtual SIZE_T GetRawBodyLength() const override
+	{
+		return Frame.Body.Num();
+	}
+
+	virtual FStompSubscriptionId GetSubscriptionId() const override
+	{
+		return SubscriptionId;
+	}
+
+	virtual FString GetDestination() const override
+	{
+		return Frame.Destination;
+	}
+
+	virtual FString GetMessageId() const override
+	{
+		return GetHeaderValue(TEXT("message-id"));
+	}
+
+	virtual FString GetAckId() const override
+	{
+		return GetHeaderValue(TEXT("ack"));
+	}
+
+	virtual void Ack(const FStompHeader& Header, const FStompRequestCompleted& CompletionCallback) const override
+	{
+		CompletionCallback.ExecuteIfBound(true, FString());
+	}
+
+	virtual void Nack(const FStompHeader& Header, const FStompRequestCompleted& CompletionCallback) const override
+	{
+		CompletionCallback.ExecuteIfBound(true, FString());
+	}
+
+private:
+	FString GetHeaderValue(const TCHAR* Name) const
+	{
+		const FString* Value = Frame.Header.Find(Name);
+		return Value ? *Value : FString();
+	}
+
+	const FSTOMPTrafficCapture::FFrame& Frame;
+	const FString& SubscriptionId;
+};
@@ -0,0 +1,34 @@
+// Copyright 2020 Richard W. Van Tassel. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "IStompClient.h"
+#include "STOMPOutboundScheduler.h"
+
+/**
+ * Send a frame through Client now if the scheduler admits it, otherwise queue a copy for a later Pump.
+ * Client is read when the queued send runs, so it must outlive the scheduler; the clients own both.
+ */
+inline void ScheduleStompSend(FSTOMPOutboundScheduler& Scheduler, const TSharedPtr<IStompClient>& Client, ESTOMPTrafficLane Lane,
+	const FString& Destination, const TArray<uint8>& Body, const TMap<FName, FString>& Header, const FStompRequestCompleted& CompletionCallback)
+{
+	const ESTOMPTrafficLane ResolvedLane = Scheduler.ResolveLane(Lane, Destination);
+	if (Scheduler.TryAdmit(ResolvedLane, Body.Num()))
+	{
+		Client->Send(Destination, Body, Header, CompletionCallback);
+		return;
+	}
+
+	Scheduler.Enqueue(ResolvedLane, Body.Num(), [&Client, Destination, Body, Header, CompletionCallback]()
+	{
+		if (Client.IsValid())
+		{
+			Client->Send(Destination, Body, Header, CompletionCallback);
+		}
+		else
+		{
+			CompletionCallback.ExecuteIfBound(false, TEXT("Client was destroyed before the frame was sent"));
+		}
+	});
+}
@@ -0,0 +1,88 @@
+// Copyright 2020 Richard W. Van Tassel. All Rights Reserved.
+
+#include "STOMPSharedTicker.h"
+
+FSTOMPSharedTicker& FSTOMPSharedTicker::Get()
+{
+	static FSTOMPSharedTicker Instance;
+	return Instance;
+}
+
+FDelegateHandle FSTOMPSharedTicker::Add(const FTickerDelegate& Delegate, float Interval)
+{
+	FEntry& Entry = Entries.AddDefaulted_GetRef();
+	Entry.Handle = FDelegateHandle(FDelegateHandle::GenerateNewHandle);
+	Entry.Delegate = Delegate;
+	Entry.Interval = Interval;
+	Entry.Elapsed = 0.f;
+
+	if (!TickerHandle.IsValid())
+	{
+		TickerHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateRaw(this, &FSTOMPSharedTicker::Tick));
+	}
+	return Entry.Handle;
+}
+
+void FSTOMPSharedTicker::Remove(FDelegateHandle& Handle)
+{
+	if (!Handle.IsValid())
+	{
+		return;
+	}
+
+	// Unbinding rather than removing keeps indices stable while Tick is iterating
+	for (FEntry& Entry : Entries)
+	{
+		if (Entry.Handle == Handle)
+		{
+			Entry.Delegate.Unbind();
+			break;
+		}
+	}
+	Handle.Reset();
+}
+
+void FSTOMPSharedTicker::Shutdown()
+{
+	// The core ticker outlives this module, so it must not keep a delegate into unloaded code
+	if (TickerHandle.IsValid())
+	{
+		FTSTicker::GetCoreTicker().RemoveTicker(TickerHandle);
+		TickerHandle.Reset();
+	}
+	Entries.Empty();
+}
+
+bool FSTOMPSharedTicker::Tick(float DeltaTime)
+{
+	for (int32 Index = 0; Index < Entries.Num(); ++Index)
+	{
+		if (!Entries[Index].Delegate.IsBound())
+		{
+			continue;
+		}
+
+		Entries[Index].Elapsed += DeltaTime;
+		if (Entries[Index].Elapsed < Entries[Index].Interval)
+		{
+			continue;
+		}
+
+		// Callbacks may add entries, so run a copy in case the array reallocates
+		const float Elapsed = Entries[Index].Elapsed;
+		const FTickerDelegate Delegate = Entries[Index].Delegate;
+		Entries[Index].Elapsed = 0.f;
+		if (!Delegate.Execute(Elapsed))
+		{
+			Entries[Index].Delegate.Unbind();
+		}
+	}
+
+	Entries.RemoveAll([](const FEntry& Entry) { return !Entry.Delegate.IsBound(); });
+	if (Entries.Num() == 0)
+	{
+		TickerHandle.Reset();
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,49 @@
+// Copyright 2020 Richard W. Van Tassel. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/Ticker.h"
+
+/**
+ * A single core ticker registration shared by every STOMP client.
+ *
+ * Clients add callbacks only while they have work to do, so idle clients cost nothing
+ * per frame, and the core ticker itself is only registered while any callback exists.
+ * A callback is dropped once it returns false or its object is gone.
+ */
+class FSTOMPSharedTicker
+{
+public:
+	/** Seconds between periodic flushes of journals and captures to disk. */
+	static constexpr float FlushInterval = 1.f;
+
+	static FSTOMPSharedTicker& Get();
+
+	/**
+	 * Add a callback.
+	 * @param Delegate Called with the time since it last ran. Return false to stop.
+	 * @param Interval Seconds between calls. Zero runs the callback every tick.
+	 */
+	FDelegateHandle Add(const FTickerDelegate& Delegate, float Interval = 0.f);
+
+	/** Remove a callback. Safe to call from inside a callback. */
+	void Remove(FDelegateHandle& Handle);
+
+	/** Drop every callback and unregister from the core ticker, e.g. before the module is unloaded. */
+	void Shutdown();
+
+private:
+	struct FEntry
+	{
+		FDelegateHandle Handle;
+		FTickerDelegate Delegate;
+		float Interval;
+		float Elapsed;
+	};
+
+	bool Tick(float DeltaTime);
+
+	TArray<FEntry> Entries;
+	FTSTicker::FDelegateHandle TickerHandle;
+};
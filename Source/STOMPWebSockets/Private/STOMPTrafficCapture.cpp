@@ -0,0 +1,224 @@
+// Copyright 2020 Richard W. Van Tassel. All Rights Reserved.
+
+#include "STOMPTrafficCapture.h"
+#include "STOMPWebSockets.h"
+#include "STOMPFrameSerialization.h"
+#include "IStompMessage.h"
+#include "HAL/FileManager.h"
+#include "HAL/PlatformTime.h"
+#include "Misc/FileHelper.h"
+#include "Serialization/MemoryReader.h"
+
+namespace STOMPTrafficCapture
+{
+	/** "SWC1" */
+	static const uint32 FileMagic = 0x31435753;
+	static const uint32 FileVersion = 1;
+
+	/** Direction and command share the first byte of each record. */
+	static const uint8 OutboundBit = 0x80;
+}
+
+FSTOMPTrafficCapture::FSTOMPTrafficCapture(const FString& InPath)
+	: Path(InPath)
+	, StartSeconds(0.0)
+	, LastMicroseconds(0)
+{
+}
+
+FSTOMPTrafficCapture::~FSTOMPTrafficCapture()
+{
+	Close();
+}
+
+bool FSTOMPTrafficCapture::Open()
+{
+	using namespace STOMPTrafficCapture;
+
+	Writer.Reset(IFileManager::Get().CreateFileWriter(*Path));
+	if (!Writer.IsValid())
+	{
+		UE_LOG(LogSTOMPWebSockets, Error, TEXT("Could not create traffic capture %s"), *Path);
+		return false;
+	}
+
+	uint32 Magic = FileMagic;
+	uint32 Version = FileVersion;
+	*Writer << Magic;
+	*Writer << Version;
+
+	StartSeconds = FPlatformTime::Seconds();
+	LastMicroseconds = 0;
+	return true;
+}
+
+void FSTOMPTrafficCapture::Close()
+{
+	if (Writer.IsValid())
+	{
+		Writer->Close();
+		Writer.Reset();
+	}
+}
+
+void FSTOMPTrafficCapture::Flush()
+{
+	if (Writer.IsValid())
+	{
+		Writer->Flush();
+	}
+}
+
+void FSTOMPTrafficCapture::Record(EDirection Direction, ECommand Command, const FString& Destination, const FString& SubscriptionId,
+	const TMap<FName, FString>& Header, const uint8* Body, int32 BodyLength)
+{
+	using namespace STOMPTrafficCapture;
+
+	if (!Writer.IsValid())
+	{
+		return;
+	}
+
+	const uint64 Microseconds = (uint64)((FPlatformTime::Seconds() - StartSeconds) * 1000000.0);
+	uint32 Delta = (uint32)FMath::Min<uint64>(Microseconds - FMath::Min(Microseconds, LastMicroseconds), MAX_uint32);
+	LastMicroseconds += Delta;
+
+	uint8 Kind = (uint8)Command | (Direction == EDirection::Outbound ? OutboundBit : 0);
+	FString DestinationCopy = Destination;
+	FString SubscriptionIdCopy = SubscriptionId;
+	TMap<FName, FString> HeaderCopy = Header;
+	uint32 BodySize = Body ? BodyLength : 0;
+
+	FArchive& Ar = *Writer;
+	Ar << Kind;
+	Ar.SerializeIntPacked(Delta);
+	Ar << DestinationCopy;
+	Ar << SubscriptionIdCopy;
+	SerializeStompHeader(Ar, HeaderCopy);
+	Ar.SerializeIntPacked(BodySize);
+	if (BodySize > 0)
+	{
+		Ar.Serialize(const_cast<uint8*>(Body), BodySize);
+	}
+}
+
+void FSTOMPTrafficCapture::RecordMessage(const IStompMessage& Message)
+{
+	Record(EDirection::Inbound, ECommand::Message, Message.GetDestination(), Message.GetSubscriptionId(),
+		Message.GetHeader(), Message.GetRawBody(), Message.GetRawBodyLength());
+}
+
+bool FSTOMPTrafficCapture::Load(const FString& Path, TArray<FFrame>& OutFrames)
+{
+	using namespace STOMPTrafficCapture;
+
+	TArray<uint8> Data;
+	if (!FFileHelper::LoadFileToArray(Data, *Path))
+	{
+		UE_LOG(LogSTOMPWebSockets, Error, TEXT("Could not read traffic capture %s"), *Path);
+		return false;
+	}
+
+	FMemoryReader Ar(Data);
+	uint32 Magic = 0;
+	uint32 Version = 0;
+	Ar << Magic;
+	Ar << Version;
+	if (Magic != FileMagic || Version != FileVersion)
+	{
+		UE_LOG(LogSTOMPWebSockets, Error, TEXT("%s is not a traffic capture"), *Path);
+		return false;
+	}
+
+	uint64 Microseconds = 0;
+	while (!Ar.AtEnd() && !Ar.IsError())
+	{
+		FFrame Frame;
+		uint8 Kind = 0;
+		uint32 Delta = 0;
+		uint32 BodySize = 0;
+		Ar << Kind;
+		Ar.SerializeIntPacked(Delta);
+		Ar << Frame.Destination;
+		Ar << Frame.SubscriptionId;
+		SerializeStompHeader(Ar, Frame.Header);
+		Ar.SerializeIntPacked(BodySize);
+		if (Ar.IsError() || BodySize > Ar.TotalSize() - Ar.Tell())
+		{
+			UE_LOG(LogSTOMPWebSockets, Warning, TEXT("Traffic capture %s is truncated after %d frames"), *Path, OutFrames.Num());
+			break;
+		}
+
+		Frame.Body.SetNumUninitialized(BodySize);
+		Ar.Serialize(Frame.Body.GetData(), BodySize);
+
+		Microseconds += Delta;
+		Frame.Time = Microseconds / 1000000.0;
+		Frame.Direction = (Kind & OutboundBit) ? EDirection::Outbound : EDirection::Inbound;
+		Frame.Command = (ECommand)(Kind & ~OutboundBit);
+		OutFrames.Add(MoveTemp(Frame));
+	}
+	return true;
+}
+
+FSTOMPTrafficReplay::FSTOMPTrafficReplay(TArray<FSTOMPTrafficCapture::FFrame>&& InFrames, float InSpeed)
+	: Cursor(0)
+	, Clock(0.0)
+	, Speed(InSpeed)
+	, StartSeconds(FPlatformTime::Seconds())
+	, DispatchCycles(0)
+{
+	using EDirection = FSTOMPTrafficCapture::EDirection;
+	using ECommand = FSTOMPTrafficCapture::ECommand;
+
+	// Walk the capture in order so a subscription id reused after an unsubscribe routes correctly
+	TMap<FString, FString> Subscribed;
+	for (FSTOMPTrafficCapture::FFrame& Frame : InFrames)
+	{
+		if (Frame.Direction == EDirection::Outbound && Frame.Command == ECommand::Subscribe)
+		{
+			Subscribed.Add(Frame.SubscriptionId, Frame.Destination);
+		}
+		else if (Frame.Direction == EDirection::Outbound && Frame.Command == ECommand::Unsubscribe)
+		{
+			Subscribed.Remove(Frame.SubscriptionId);
+		}
+		else if (Frame.Direction == EDirection::Inbound && Frame.Command == ECommand::Message)
+		{
+			const FString* Destination = Subscribed.Find(Frame.SubscriptionId);
+			SubscribedDestinations.Add(Destination ? *Destination : Frame.Destination);
+			Frames.Add(MoveTemp(Frame));
+		}
+	}
+	InFrames.Empty();
+
+	// Start at the first message rather than replaying the idle time before it
+	if (Frames.Num() > 0)
+	{
+		Clock = Frames[0].Time;
+	}
+}
+
+bool FSTOMPTrafficReplay::Step(float DeltaTime, TFunctionRef<void(const FSTOMPTrafficCapture::FFrame&, const FString&)> Dispatch)
+{
+	Clock += DeltaTime * Speed;
+
+	while (Cursor < Frames.Num() && (IsMaxSpeed() || Frames[Cursor].Time <= Clock))
+	{
+		const uint64 StartCycles = FPlatformTime::Cycles64();
+		Dispatch(Frames[Cursor], SubscribedDestinations[Cursor]);
+		++Cursor;
+		DispatchCycles += FPlatformTime::Cycles64() - StartCycles;
+	}
+	return IsFinished();
+}
+
+FString FSTOMPTrafficReplay::GetSummary() const
+{
+	const double WallSeconds = FPlatformTime::Seconds() - StartSeconds;
+	const double DispatchSeconds = FPlatformTime::ToSeconds64(DispatchCycles);
+	return FString::Printf(TEXT("%d of %d frames in %.3f s (%.0f frames/s), %.2f us dispatch time per frame"),
+		Cursor, Frames.Num(), WallSeconds,
+		WallSeconds > 0.0 ? Cursor / WallSeconds : 0.0,
+		Cursor > 0 ? DispatchSeconds * 1000000.0 / Cursor : 0.0);
+}
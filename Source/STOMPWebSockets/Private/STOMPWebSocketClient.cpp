@@ -7,14 +7,33 @@
 #include "IStompMessage.h"
 #include "StompModule.h"
 #include "IStompClient.h"
+#include "STOMPClientCore.h"
+
+namespace STOMPWebSocketClient
+{
+	static FStompRequestCompleted WrapCompletion(const FSTOMPRequestCompleted& CompletionCallback)
+	{
+		if (!CompletionCallback.IsBound())
+		{
+			return FStompRequestCompleted();
+		}
+
+		return FStompRequestCompleted::CreateLambda([CompletionCallback](bool bSuccess, const FString& Error)->void {
+			CompletionCallback.ExecuteIfBound(bSuccess, Error);
+		});
+	}
+}
 
 // Sets default values for this component's properties
 USTOMPWebSocketClient::USTOMPWebSocketClient()
 {
-	// Set this component to be initialized when the game starts, and to be ticked every frame.  You can turn these features
-	// off to improve performance if you don't need them.
+	// Set this component to be initialized when the game starts. It only ticks while there is queued work,
+	// such as queued sends, journaled frames to drain or a replay in progress, so idle clients cost nothing per frame.
 	PrimaryComponentTick.bCanEverTick = true;
-	// ...
+	PrimaryComponentTick.bStartWithTickEnabled = false;
+
+	Core = MakeShared<FSTOMPClientCore>(this);
+	Core->OnQueuedWorkChanged.BindUObject(this, &USTOMPWebSocketClient::UpdateQueuedWork);
 }
 
 // Called when the game starts
@@ -23,6 +42,26 @@ void USTOMPWebSocketClient::BeginPlay()
 	Super::BeginPlay();
 }
 
+void USTOMPWebSocketClient::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	// Outstanding journal and replay callbacks are failed here, while it is still safe to call into Blueprint
+	Core->DisableOutboundJournal();
+	Core->StopReplay();
+	Core->StopCapture();
+
+	Super::EndPlay(EndPlayReason);
+}
+
+void USTOMPWebSocketClient::AddReferencedObjects(UObject* InThis, FReferenceCollector& Collector)
+{
+	USTOMPWebSocketClient* This = CastChecked<USTOMPWebSocketClient>(InThis);
+	if (This->Core.IsValid())
+	{
+		This->Core->AddReferencedObjects(Collector);
+	}
+	Super::AddReferencedObjects(InThis, Collector);
+}
+
 void USTOMPWebSocketClient::SetUrl(FString NewUrl)
 {
 	Url = NewUrl;
@@ -43,10 +82,23 @@ const FString USTOMPWebSocketClient::GetAuthToken()
 	return AuthToken;
 }
 
+void USTOMPWebSocketClient::SetRecycleMessages(bool bNewRecycleMessages)
+{
+	Core->SetRecycleMessages(bNewRecycleMessages);
+}
+
+const bool USTOMPWebSocketClient::GetRecycleMessages()
+{
+	return Core->GetRecycleMessages();
+}
+
 // Called every frame
 void USTOMPWebSocketClient::TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
 {
 	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
+
+	Core->Tick(DeltaTime);
+	UpdateQueuedWork();
 }
 
 /**
@@ -64,14 +116,15 @@ void USTOMPWebSocketClient::BuildClient()
 		StompClient->OnConnected().Clear();
 		StompClient->OnConnectionError().Clear();
 		StompClient->OnError().Clear();
-		StompClient->OnClosed().Clear();	
+		StompClient->OnClosed().Clear();
 
 		delete StompClient.Get();
 	}
 
-	
+
 	FStompModule* stompModule = &FStompModule::Get();
 	StompClient = stompModule->CreateClient(Url, AuthToken);
+	Core->SetStompClient(StompClient);
 
 	StompClient->OnConnected().AddUObject(this, &USTOMPWebSocketClient::HandleOnConnected);
 	StompClient->OnConnectionError().AddUObject(this, &USTOMPWebSocketClient::HandleOnConnectionError);
@@ -118,20 +171,30 @@ const bool USTOMPWebSocketClient::IsConnected()
  */
 FString USTOMPWebSocketClient::Subscribe(const FString& Destination, const FSTOMPSubscriptionEvent& EventCallback, const FSTOMPRequestCompleted& CompletionCallback)
 {
-	return StompClient->Subscribe(Destination, 
-		FStompSubscriptionEvent::CreateLambda([this, EventCallback](const IStompMessage& Message)->void {
-			USTOMPWebSocketMessage* msg = NewObject<USTOMPWebSocketMessage>(this);
-			msg->MyMessage = &Message;
-			EventCallback.ExecuteIfBound(msg);
-			msg->ConditionalBeginDestroy();
+	return Core->Subscribe(Destination,
+		FSTOMPMessageEvent::CreateLambda([EventCallback](USTOMPWebSocketMessage* Message)->void {
+			EventCallback.ExecuteIfBound(Message);
 		}),
-		FStompRequestCompleted::CreateLambda([CompletionCallback](bool bSuccess, const FString& Error)->void {
-			CompletionCallback.ExecuteIfBound(bSuccess, Error);
-		})
+		STOMPWebSocketClient::WrapCompletion(CompletionCallback)
 	);
 }
 
 
+/**
+ * Subscribe to messages replayed by ReplayCapture, without subscribing on the server.
+ * @param Destination Destination endpoint the captured messages were subscribed on.
+ * @param EventCallback Delegate called when replayed messages arrive on this subscription.
+ * @return a handle to the subscription. Can be passed to Unsubscribe to remove it.
+ */
+FString USTOMPWebSocketClient::SubscribeForReplay(const FString& Destination, const FSTOMPSubscriptionEvent& EventCallback)
+{
+	return Core->SubscribeForReplay(Destination,
+		FSTOMPMessageEvent::CreateLambda([EventCallback](USTOMPWebSocketMessage* Message)->void {
+			EventCallback.ExecuteIfBound(Message);
+		})
+	);
+}
+
 /**
  * Unsubscribe from an event
  * @param Subscription The id returned from the call to Subscribe.
@@ -140,11 +203,7 @@ FString USTOMPWebSocketClient::Subscribe(const FString& Destination, const FSTOM
  */
 void USTOMPWebSocketClient::Unsubscribe(FString Subscription, const FSTOMPRequestCompleted& CompletionCallback)
 {
-	StompClient->Unsubscribe(Subscription,
-		FStompRequestCompleted::CreateLambda([CompletionCallback](bool bSuccess, const FString& Error)->void {
-			CompletionCallback.ExecuteIfBound(bSuccess, Error);
-		})
-	);
+	Core->Unsubscribe(Subscription, STOMPWebSocketClient::WrapCompletion(CompletionCallback));
 }
 
 /**
@@ -153,24 +212,121 @@ void USTOMPWebSocketClient::Unsubscribe(FString Subscription, const FSTOMPReques
  * @param Body The event body as a binary blob.
  * @param Header Custom header values to send along with the data.
  * @param CompletionCallback Delegate called when the request has been acknowledged by the server or if there is an error.
+ * @param Lane Outbound lane to schedule the frame on.
  */
-void USTOMPWebSocketClient::SendBinary(const FString& Destination, const TArray<uint8>& Body, const TMap<FName, FString>& Header, 
-	const FSTOMPRequestCompleted& CompletionCallback)
+void USTOMPWebSocketClient::SendBinary(const FString& Destination, const TArray<uint8>& Body, const TMap<FName, FString>& Header,
+	const FSTOMPRequestCompleted& CompletionCallback, ESTOMPTrafficLane Lane)
 {
-	StompClient->Send(Destination, Body, Header,
-		FStompRequestCompleted::CreateLambda([CompletionCallback](bool bSuccess, const FString& Error)->void {
-			CompletionCallback.ExecuteIfBound(bSuccess, Error);
-		})
-	);
+	Core->Send(Destination, Body, Header, STOMPWebSocketClient::WrapCompletion(CompletionCallback), Lane);
+}
+
+/**
+ * Set the outbound lane used for sends to a destination that ask for the Default lane.
+ * @param Destination The destination endpoint.
+ * @param Lane Lane for the destination. Default goes back to Interactive.
+ */
+void USTOMPWebSocketClient::SetDestinationLane(const FString& Destination, ESTOMPTrafficLane Lane)
+{
+	Core->SetDestinationLane(Destination, Lane);
+}
+
+/**
+ * Tune how queued interactive and bulk sends are drained each tick.
+ * @param InteractiveWeight Share of each drain round given to the interactive lane.
+ * @param BulkWeight Share of each drain round given to the bulk lane.
+ * @param BulkBytesPerTick Cap on bulk body bytes sent per tick. Larger frames are queued, not split.
+ */
+void USTOMPWebSocketClient::SetOutboundSchedule(int32 InteractiveWeight, int32 BulkWeight, int32 BulkBytesPerTick)
+{
+	Core->SetOutboundSchedule(InteractiveWeight, BulkWeight, BulkBytesPerTick);
+}
+
+/**
+ * Enable store-and-forward for outbound frames.
+ * @param JournalPath File backing the journal. Frames left unreceipted by an earlier session are recovered from it.
+ * @param MaxBytes Cap on the size of the unreceipted frames held by the journal.
+ * @param OverflowPolicy What to do when a new frame would exceed MaxBytes.
+ * @param DrainRate Maximum frames per second sent from the journal. Zero means unlimited.
+ * @return true if the journal file could be opened.
+ */
+bool USTOMPWebSocketClient::EnableOutboundJournal(const FString& JournalPath, int64 MaxBytes, ESTOMPJournalOverflowPolicy OverflowPolicy, float DrainRate)
+{
+	return Core->EnableOutboundJournal(JournalPath, MaxBytes, OverflowPolicy, DrainRate);
+}
+
+/**
+ * Stop journaling outbound frames.
+ * Unreceipted frames stay on disk and are recovered when the journal is enabled again on the same file.
+ */
+void USTOMPWebSocketClient::DisableOutboundJournal()
+{
+	Core->DisableOutboundJournal();
+}
+
+/**
+ * Number of journaled frames the server has not receipted yet.
+ */
+int32 USTOMPWebSocketClient::GetJournaledFrameCount()
+{
+	return Core->GetJournaledFrameCount();
+}
+
+/**
+ * Start recording every frame sent or received by this client into a capture file.
+ * @param CapturePath File to write the capture to. An existing file is replaced.
+ * @return true if the capture file could be created.
+ */
+bool USTOMPWebSocketClient::StartCapture(const FString& CapturePath)
+{
+	return Core->StartCapture(CapturePath);
+}
+
+/**
+ * Stop recording and close the capture file.
+ */
+void USTOMPWebSocketClient::StopCapture()
+{
+	Core->StopCapture();
+}
+
+/**
+ * Feed the inbound messages of a capture through this client's subscriptions without any network traffic.
+ * @param CapturePath File written by an earlier StartCapture.
+ * @param Speed Playback speed multiplier. Zero delivers every message at once, as fast as possible.
+ * @param CompletionCallback Delegate called when the replay has finished or if the capture could not be read.
+ * @return true if the capture could be read.
+ */
+bool USTOMPWebSocketClient::ReplayCapture(const FString& CapturePath, float Speed, const FSTOMPRequestCompleted& CompletionCallback)
+{
+	return Core->ReplayCapture(CapturePath, Speed, STOMPWebSocketClient::WrapCompletion(CompletionCallback));
+}
+
+/**
+ * Abandon a replay in progress.
+ */
+void USTOMPWebSocketClient::StopReplay()
+{
+	Core->StopReplay();
+}
+
+void USTOMPWebSocketClient::UpdateQueuedWork()
+{
+	const bool bHasQueuedWork = Core->HasQueuedWork();
+	if (IsComponentTickEnabled() != bHasQueuedWork)
+	{
+		SetComponentTickEnabled(bHasQueuedWork);
+	}
 }
 
-void USTOMPWebSocketClient::HandleOnConnected(const FString& ProtocolVersion, const FString& SessionId, const FString& ServerString) 
+void USTOMPWebSocketClient::HandleOnConnected(const FString& ProtocolVersion, const FString& SessionId, const FString& ServerString)
 {
+	Core->HandleConnected();
 	this->OnConnected.Broadcast(ProtocolVersion, SessionId, ServerString);
 }
 
 void USTOMPWebSocketClient::HandleOnConnectionError(const FString& Error)
 {
+	Core->HandleDisconnected();
 	this->OnConnectionError.Broadcast(Error);
 }
 
@@ -181,5 +337,6 @@ void USTOMPWebSocketClient::HandleOnError(const FString& Error)
 
 void USTOMPWebSocketClient::HandleOnClosed(const FString& Reason)
 {
+	Core->HandleDisconnected();
 	this->OnClosed.Broadcast(Reason);
 }
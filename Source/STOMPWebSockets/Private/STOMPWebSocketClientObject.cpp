@@ -7,12 +7,36 @@
 #include "IStompMessage.h"
 #include "StompModule.h"
 #include "IStompClient.h"
+#include "STOMPClientCore.h"
+#include "STOMPSharedTicker.h"
+
+namespace STOMPWebSocketClientObject
+{
+	static FStompRequestCompleted WrapCompletion(const FSTOMPRequestCompletedObject& CompletionCallback)
+	{
+		if (!CompletionCallback.IsBound())
+		{
+			return FStompRequestCompleted();
+		}
+
+		return FStompRequestCompleted::CreateLambda([CompletionCallback](bool bSuccess, const FString& Error)->void {
+			CompletionCallback.ExecuteIfBound(bSuccess, Error);
+		});
+	}
+}
+
+USTOMPWebSocketClientObject::USTOMPWebSocketClientObject()
+{
+	Core = MakeShared<FSTOMPClientCore>(this);
+	Core->OnQueuedWorkChanged.BindUObject(this, &USTOMPWebSocketClientObject::UpdateQueuedWork);
+}
 
 // Called when the game starts
 void USTOMPWebSocketClientObject::Initialize()
 {
 	FStompModule* stompModule = &FStompModule::Get();
 	StompClient = stompModule->CreateClient(Url, AuthToken);
+	Core->SetStompClient(StompClient);
 
 	StompClient->OnConnected().AddUObject(this, &USTOMPWebSocketClientObject::HandleOnConnected);
 	StompClient->OnConnectionError().AddUObject(this, &USTOMPWebSocketClientObject::HandleOnConnectionError);
@@ -20,6 +44,27 @@ void USTOMPWebSocketClientObject::Initialize()
 	StompClient->OnClosed().AddUObject(this, &USTOMPWebSocketClientObject::HandleOnClosed);
 }
 
+void USTOMPWebSocketClientObject::BeginDestroy()
+{
+	// Blueprint callbacks must not run during garbage collection, so outstanding ones are dropped rather than failed
+	if (Core.IsValid())
+	{
+		Core->Shutdown();
+	}
+	FSTOMPSharedTicker::Get().Remove(QueuedWorkHandle);
+	Super::BeginDestroy();
+}
+
+void USTOMPWebSocketClientObject::AddReferencedObjects(UObject* InThis, FReferenceCollector& Collector)
+{
+	USTOMPWebSocketClientObject* This = CastChecked<USTOMPWebSocketClientObject>(InThis);
+	if (This->Core.IsValid())
+	{
+		This->Core->AddReferencedObjects(Collector);
+	}
+	Super::AddReferencedObjects(InThis, Collector);
+}
+
 void USTOMPWebSocketClientObject::SetUrl(FString NewUrl)
 {
 	Url = NewUrl;
@@ -40,6 +85,16 @@ FString USTOMPWebSocketClientObject::GetAuthToken()
 	return AuthToken;
 }
 
+void USTOMPWebSocketClientObject::SetRecycleMessages(bool bNewRecycleMessages)
+{
+	Core->SetRecycleMessages(bNewRecycleMessages);
+}
+
+bool USTOMPWebSocketClientObject::GetRecycleMessages()
+{
+	return Core->GetRecycleMessages();
+}
+
 /**
 * Initiate a client connection to the server.
 * Use this after setting up event handlers or to reconnect after connection errors.
@@ -78,20 +133,30 @@ bool USTOMPWebSocketClientObject::IsConnected()
  */
 FString USTOMPWebSocketClientObject::Subscribe(const FString& Destination, const FSTOMPSubscriptionEventObject& EventCallback, const FSTOMPRequestCompletedObject& CompletionCallback)
 {
-	return StompClient->Subscribe(Destination, 
-		FStompSubscriptionEvent::CreateLambda([this, EventCallback](const IStompMessage& Message)->void {
-			USTOMPWebSocketMessage* msg = NewObject<USTOMPWebSocketMessage>(this);
-			msg->MyMessage = &Message;
-			EventCallback.ExecuteIfBound(msg);
-			msg->ConditionalBeginDestroy();
+	return Core->Subscribe(Destination,
+		FSTOMPMessageEvent::CreateLambda([EventCallback](USTOMPWebSocketMessage* Message)->void {
+			EventCallback.ExecuteIfBound(Message);
 		}),
-		FStompRequestCompleted::CreateLambda([CompletionCallback](bool bSuccess, const FString& Error)->void {
-			CompletionCallback.ExecuteIfBound(bSuccess, Error);
-		})
+		STOMPWebSocketClientObject::WrapCompletion(CompletionCallback)
 	);
 }
 
 
+/**
+ * Subscribe to messages replayed by ReplayCapture, without subscribing on the server.
+ * @param Destination Destination endpoint the captured messages were subscribed on.
+ * @param EventCallback Delegate called when replayed messages arrive on this subscription.
+ * @return a handle to the subscription. Can be passed to Unsubscribe to remove it.
+ */
+FString USTOMPWebSocketClientObject::SubscribeForReplay(const FString& Destination, const FSTOMPSubscriptionEventObject& EventCallback)
+{
+	return Core->SubscribeForReplay(Destination,
+		FSTOMPMessageEvent::CreateLambda([EventCallback](USTOMPWebSocketMessage* Message)->void {
+			EventCallback.ExecuteIfBound(Message);
+		})
+	);
+}
+
 /**
  * Unsubscribe from an event
  * @param Subscription The id returned from the call to Subscribe.
@@ -100,11 +165,7 @@ FString USTOMPWebSocketClientObject::Subscribe(const FString& Destination, const
  */
 void USTOMPWebSocketClientObject::Unsubscribe(FString Subscription, const FSTOMPRequestCompletedObject& CompletionCallback)
 {
-	StompClient->Unsubscribe(Subscription,
-		FStompRequestCompleted::CreateLambda([CompletionCallback](bool bSuccess, const FString& Error)->void {
-			CompletionCallback.ExecuteIfBound(bSuccess, Error);
-		})
-	);
+	Core->Unsubscribe(Subscription, STOMPWebSocketClientObject::WrapCompletion(CompletionCallback));
 }
 
 /**
@@ -113,24 +174,132 @@ void USTOMPWebSocketClientObject::Unsubscribe(FString Subscription, const FSTOMP
  * @param Body The event body as a binary blob.
  * @param Header Custom header values to send along with the data.
  * @param CompletionCallback Delegate called when the request has been acknowledged by the server or if there is an error.
+ * @param Lane Outbound lane to schedule the frame on.
  */
 void USTOMPWebSocketClientObject::SendBinary(const FString& Destination, const TArray<uint8>& Body, const TMap<FName, FString>& Header,
-	const FSTOMPRequestCompletedObject& CompletionCallback)
+	const FSTOMPRequestCompletedObject& CompletionCallback, ESTOMPTrafficLane Lane)
 {
-	StompClient->Send(Destination, Body, Header,
-		FStompRequestCompleted::CreateLambda([CompletionCallback](bool bSuccess, const FString& Error)->void {
-			CompletionCallback.ExecuteIfBound(bSuccess, Error);
-		})
-	);
+	Core->Send(Destination, Body, Header, STOMPWebSocketClientObject::WrapCompletion(CompletionCallback), Lane);
+}
+
+/**
+ * Set the outbound lane used for sends to a destination that ask for the Default lane.
+ * @param Destination The destination endpoint.
+ * @param Lane Lane for the destination. Default goes back to Interactive.
+ */
+void USTOMPWebSocketClientObject::SetDestinationLane(const FString& Destination, ESTOMPTrafficLane Lane)
+{
+	Core->SetDestinationLane(Destination, Lane);
+}
+
+/**
+ * Tune how queued interactive and bulk sends are drained each tick.
+ * @param InteractiveWeight Share of each drain round given to the interactive lane.
+ * @param BulkWeight Share of each drain round given to the bulk lane.
+ * @param BulkBytesPerTick Cap on bulk body bytes sent per tick. Larger frames are queued, not split.
+ */
+void USTOMPWebSocketClientObject::SetOutboundSchedule(int32 InteractiveWeight, int32 BulkWeight, int32 BulkBytesPerTick)
+{
+	Core->SetOutboundSchedule(InteractiveWeight, BulkWeight, BulkBytesPerTick);
+}
+
+/**
+ * Enable store-and-forward for outbound frames.
+ * @param JournalPath File backing the journal. Frames left unreceipted by an earlier session are recovered from it.
+ * @param MaxBytes Cap on the size of the unreceipted frames held by the journal.
+ * @param OverflowPolicy What to do when a new frame would exceed MaxBytes.
+ * @param DrainRate Maximum frames per second sent from the journal. Zero means unlimited.
+ * @return true if the journal file could be opened.
+ */
+bool USTOMPWebSocketClientObject::EnableOutboundJournal(const FString& JournalPath, int64 MaxBytes, ESTOMPJournalOverflowPolicy OverflowPolicy, float DrainRate)
+{
+	return Core->EnableOutboundJournal(JournalPath, MaxBytes, OverflowPolicy, DrainRate);
+}
+
+/**
+ * Stop journaling outbound frames.
+ * Unreceipted frames stay on disk and are recovered when the journal is enabled again on the same file.
+ */
+void USTOMPWebSocketClientObject::DisableOutboundJournal()
+{
+	Core->DisableOutboundJournal();
+}
+
+/**
+ * Number of journaled frames the server has not receipted yet.
+ */
+int32 USTOMPWebSocketClientObject::GetJournaledFrameCount()
+{
+	return Core->GetJournaledFrameCount();
+}
+
+/**
+ * Start recording every frame sent or received by this client into a capture file.
+ * @param CapturePath File to write the capture to. An existing file is replaced.
+ * @return true if the capture file could be created.
+ */
+bool USTOMPWebSocketClientObject::StartCapture(const FString& CapturePath)
+{
+	return Core->StartCapture(CapturePath);
+}
+
+/**
+ * Stop recording and close the capture file.
+ */
+void USTOMPWebSocketClientObject::StopCapture()
+{
+	Core->StopCapture();
+}
+
+/**
+ * Feed the inbound messages of a capture through this client's subscriptions without any network traffic.
+ * @param CapturePath File written by an earlier StartCapture.
+ * @param Speed Playback speed multiplier. Zero delivers every message at once, as fast as possible.
+ * @param CompletionCallback Delegate called when the replay has finished or if the capture could not be read.
+ * @return true if the capture could be read.
+ */
+bool USTOMPWebSocketClientObject::ReplayCapture(const FString& CapturePath, float Speed, const FSTOMPRequestCompletedObject& CompletionCallback)
+{
+	return Core->ReplayCapture(CapturePath, Speed, STOMPWebSocketClientObject::WrapCompletion(CompletionCallback));
+}
+
+/**
+ * Abandon a replay in progress.
+ */
+void USTOMPWebSocketClientObject::StopReplay()
+{
+	Core->StopReplay();
+}
+
+void USTOMPWebSocketClientObject::UpdateQueuedWork()
+{
+	if (!QueuedWorkHandle.IsValid() && Core->HasQueuedWork())
+	{
+		QueuedWorkHandle = FSTOMPSharedTicker::Get().Add(FTickerDelegate::CreateUObject(this, &USTOMPWebSocketClientObject::TickQueuedWork));
+	}
+}
+
+bool USTOMPWebSocketClientObject::TickQueuedWork(float DeltaTime)
+{
+	Core->Tick(DeltaTime);
+
+	if (!Core->HasQueuedWork())
+	{
+		QueuedWorkHandle.Reset();
+		return false;
+	}
+	return true;
 }
 
 void USTOMPWebSocketClientObject::HandleOnConnected(const FString& ProtocolVersion, const FString& SessionId, const FString& ServerString)
 {
+	Core->HandleConnected();
 	this->OnConnected.Broadcast(ProtocolVersion, SessionId, ServerString);
 }
 
 void USTOMPWebSocketClientObject::HandleOnConnectionError(const FString& Error)
 {
+	Core->HandleDisconnected();
 	this->OnConnectionError.Broadcast(Error);
 }
 
@@ -141,5 +310,6 @@ void USTOMPWebSocketClientObject::HandleOnError(const FString& Error)
 
 void USTOMPWebSocketClientObject::HandleOnClosed(const FString& Reason)
 {
+	Core->HandleDisconnected();
 	this->OnClosed.Broadcast(Reason);
 }
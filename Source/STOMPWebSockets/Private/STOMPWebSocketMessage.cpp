@@ -2,9 +2,66 @@
 
 #include "STOMPWebSocketMessage.h"
 #include "IStompMessage.h"
+#include "STOMPTrafficCapture.h"
+#include "STOMPReplayMessage.h"
+
+namespace STOMPWebSocketMessage
+{
+	static const TCHAR* NotDeliveringError = TEXT("The message can only be acknowledged while it is being delivered");
+}
+
+USTOMPWebSocketMessage::~USTOMPWebSocketMessage()
+{
+}
+
+void USTOMPWebSocketMessage::Retain()
+{
+	if (RetainedFrame.IsValid() || !MyMessage)
+	{
+		return;
+	}
+
+	RetainedFrame = MakeUnique<FSTOMPTrafficCapture::FFrame>();
+	RetainedFrame->Destination = MyMessage->GetDestination();
+	RetainedFrame->SubscriptionId = MyMessage->GetSubscriptionId();
+	RetainedFrame->Header = MyMessage->GetHeader();
+	RetainedFrame->Body.Append(MyMessage->GetRawBody(), (int32)MyMessage->GetRawBodyLength());
+	RetainedMessage = MakeUnique<FSTOMPReplayMessage>(*RetainedFrame, RetainedFrame->SubscriptionId);
+}
+
+bool USTOMPWebSocketMessage::IsRetained() const
+{
+	return RetainedFrame.IsValid();
+}
+
+const IStompMessage* USTOMPWebSocketMessage::GetMessage() const
+{
+	const IStompMessage* Message = MyMessage ? MyMessage : RetainedMessage.Get();
+	ensureMsgf(Message, TEXT("STOMP message read after its subscription callback returned. Call Retain to keep it."));
+	return Message;
+}
+
+bool USTOMPWebSocketMessage::Release()
+{
+	MyMessage = nullptr;
+	TrafficCapture.Reset();
+	return !RetainedFrame.IsValid();
+}
 
 void USTOMPWebSocketMessage::Ack(const TMap<FName, FString>& Header, const FSTOMPRequestCompleted& CompletionCallback)
 {
+	if (!MyMessage)
+	{
+		CompletionCallback.ExecuteIfBound(false, STOMPWebSocketMessage::NotDeliveringError);
+		return;
+	}
+
+	if (TSharedPtr<FSTOMPTrafficCapture> Capture = TrafficCapture.Pin())
+	{
+		Capture->Record(FSTOMPTrafficCapture::EDirection::Outbound, FSTOMPTrafficCapture::ECommand::Ack,
+			MyMessage->GetDestination(), MyMessage->GetSubscriptionId(), Header);
+	}
+
 	MyMessage->Ack(Header, FStompRequestCompleted::CreateLambda([CompletionCallback](bool bSuccess, const FString& Error)->void {
 		CompletionCallback.Execute(bSuccess, Error);
 	}));
@@ -12,6 +69,18 @@ void USTOMPWebSocketMessage::Ack(const TMap<FName, FString>& Header, const FSTOM
 
 void USTOMPWebSocketMessage::Nack(const TMap<FName, FString>& Header, const FSTOMPRequestCompleted& CompletionCallback)
 {
+	if (!MyMessage)
+	{
+		CompletionCallback.ExecuteIfBound(false, STOMPWebSocketMessage::NotDeliveringError);
+		return;
+	}
+
+	if (TSharedPtr<FSTOMPTrafficCapture> Capture = TrafficCapture.Pin())
+	{
+		Capture->Record(FSTOMPTrafficCapture::EDirection::Outbound, FSTOMPTrafficCapture::ECommand::Nack,
+			MyMessage->GetDestination(), MyMessage->GetSubscriptionId(), Header);
+	}
+
 	MyMessage->Nack(Header, FStompRequestCompleted::CreateLambda([CompletionCallback](bool bSuccess, const FString& Error)->void {
 		CompletionCallback.Execute(bSuccess, Error);
 	}));
@@ -19,40 +88,49 @@ void USTOMPWebSocketMessage::Nack(const TMap<FName, FString>& Header, const FSTO
 
 const TMap<FName, FString>& USTOMPWebSocketMessage::GetHeader() const
 {
-	return MyMessage->GetHeader();
+	static const TMap<FName, FString> EmptyHeader;
+	const IStompMessage* Message = GetMessage();
+	return Message ? Message->GetHeader() : EmptyHeader;
 }
 
 FString USTOMPWebSocketMessage::GetBodyAsString() const
 {
-	return MyMessage->GetBodyAsString();
+	const IStompMessage* Message = GetMessage();
+	return Message ? FString(Message->GetBodyAsString()) : FString();
 }
 
 const TArray<uint8> USTOMPWebSocketMessage::GetRawBody() const
 {
-	return TArray<uint8>(MyMessage->GetRawBody(), MyMessage->GetRawBodyLength());
+	const IStompMessage* Message = GetMessage();
+	return Message ? TArray<uint8>(Message->GetRawBody(), Message->GetRawBodyLength()) : TArray<uint8>();
 }
 
 int32 USTOMPWebSocketMessage::GetRawBodyLength() const
 {
-	return MyMessage->GetRawBodyLength();
+	const IStompMessage* Message = GetMessage();
+	return Message ? Message->GetRawBodyLength() : 0;
 }
 
 FString USTOMPWebSocketMessage::GetSubscriptionId() const
 {
-	return MyMessage->GetSubscriptionId();
+	const IStompMessage* Message = GetMessage();
+	return Message ? FString(Message->GetSubscriptionId()) : FString();
 }
 
 FString USTOMPWebSocketMessage::GetDestination() const
 {
-	return MyMessage->GetDestination();
+	const IStompMessage* Message = GetMessage();
+	return Message ? FString(Message->GetDestination()) : FString();
 }
 
 FString USTOMPWebSocketMessage::GetMessageId() const
 {
-	return MyMessage->GetMessageId();
+	const IStompMessage* Message = GetMessage();
+	return Message ? FString(Message->GetMessageId()) : FString();
 }
 
 FString USTOMPWebSocketMessage::GetAckId() const
 {
-	return MyMessage->GetAckId();
+	const IStompMessage* Message = GetMessage();
+	return Message ? FString(Message->GetAckId()) : FString();
 }
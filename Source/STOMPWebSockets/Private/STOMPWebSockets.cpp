@@ -2,13 +2,21 @@
 
 #include "STOMPWebSockets.h"
 #include "StompModule.h"
+#include "STOMPSharedTicker.h"
 
 #define LOCTEXT_NAMESPACE "FSTOMPWebSocketsModule"
 #undef LOCTEXT_NAMESPACE
 	
 IMPLEMENT_MODULE(FSTOMPWebSocketsModule, STOMPWebSockets)
 
+DEFINE_LOG_CATEGORY(LogSTOMPWebSockets);
+
 void FSTOMPWebSocketsModule::StartupModule()
 {
 	FModuleManager::LoadModuleChecked<FStompModule>("Stomp");
 }
+
+void FSTOMPWebSocketsModule::ShutdownModule()
+{
+	FSTOMPSharedTicker::Get().Shutdown();
+}
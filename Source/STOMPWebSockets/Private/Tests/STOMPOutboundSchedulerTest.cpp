@@ -0,0 +1,116 @@
+// Copyright 2020 Richard W. Van Tassel. All Rights Reserved.
+
+#include "Misc/AutomationTest.h"
+#include "STOMPOutboundScheduler.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace STOMPOutboundSchedulerTest
+{
+	/** Bytes per test frame, one drain quantum, so a lane of weight N sends N frames per round. */
+	static const int32 FrameBytes = 1500;
+
+	/** Send the way ScheduleStompSend does, appending Name to Order when the frame goes out. */
+	static void Send(FSTOMPOutboundScheduler& Scheduler, ESTOMPTrafficLane Lane, const FString& Name, FString& Order)
+	{
+		if (Scheduler.TryAdmit(Lane, FrameBytes))
+		{
+			Order += Name + TEXT(" ");
+			return;
+		}
+
+		Scheduler.Enqueue(Lane, FrameBytes, [Name, &Order]()
+		{
+			Order += Name + TEXT(" ");
+		});
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSTOMPOutboundSchedulerInterleaveTest, "STOMPWebSockets.OutboundScheduler.Interleave",
+	EAutomationTestFlags_ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FSTOMPOutboundSchedulerInterleaveTest::RunTest(const FString& Parameters)
+{
+	using namespace STOMPOutboundSchedulerTest;
+
+	FSTOMPOutboundScheduler Scheduler;
+	Scheduler.Configure(2, 1, FrameBytes * 2);
+
+	// The first two bulk frames fit the budget and go out at once; the rest wait, and interactive sends wait behind them
+	FString Order;
+	for (int32 Index = 1; Index <= 4; ++Index)
+	{
+		Send(Scheduler, ESTOMPTrafficLane::Bulk, FString::Printf(TEXT("B%d"), Index), Order);
+	}
+	for (int32 Index = 1; Index <= 4; ++Index)
+	{
+		Send(Scheduler, ESTOMPTrafficLane::Interactive, FString::Printf(TEXT("I%d"), Index), Order);
+	}
+	Send(Scheduler, ESTOMPTrafficLane::Control, TEXT("C"), Order);
+	TestEqual(TEXT("Sent before Pump"), Order, TEXT("B1 B2 C "));
+
+	Order.Reset();
+	Scheduler.Pump();
+	TestEqual(TEXT("Sent by Pump"), Order, TEXT("I1 I2 B3 I3 I4 B4 "));
+	TestFalse(TEXT("Queue drained"), Scheduler.HasQueued());
+
+	Order.Reset();
+	Send(Scheduler, ESTOMPTrafficLane::Interactive, TEXT("I5"), Order);
+	TestEqual(TEXT("Interactive send with nothing queued"), Order, TEXT("I5 "));
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSTOMPOutboundSchedulerWeightsTest, "STOMPWebSockets.OutboundScheduler.Weights",
+	EAutomationTestFlags_ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FSTOMPOutboundSchedulerWeightsTest::RunTest(const FString& Parameters)
+{
+	using namespace STOMPOutboundSchedulerTest;
+
+	FSTOMPOutboundScheduler Scheduler;
+	Scheduler.Configure(1, 3, FrameBytes * 100);
+
+	FString Order;
+	for (int32 Index = 1; Index <= 6; ++Index)
+	{
+		Scheduler.Enqueue(ESTOMPTrafficLane::Bulk, FrameBytes, [Index, &Order]() { Order += FString::Printf(TEXT("B%d "), Index); });
+	}
+	for (int32 Index = 1; Index <= 3; ++Index)
+	{
+		Scheduler.Enqueue(ESTOMPTrafficLane::Interactive, FrameBytes, [Index, &Order]() { Order += FString::Printf(TEXT("I%d "), Index); });
+	}
+
+	Scheduler.Pump();
+	TestEqual(TEXT("Bulk weighted 3 to 1"), Order, TEXT("I1 B1 B2 B3 I2 B4 B5 B6 I3 "));
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSTOMPOutboundSchedulerBudgetTest, "STOMPWebSockets.OutboundScheduler.BulkBudget",
+	EAutomationTestFlags_ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FSTOMPOutboundSchedulerBudgetTest::RunTest(const FString& Parameters)
+{
+	using namespace STOMPOutboundSchedulerTest;
+
+	FSTOMPOutboundScheduler Scheduler;
+	Scheduler.Configure(4, 1, FrameBytes * 2);
+
+	int32 Sent = 0;
+	for (int32 Index = 0; Index < 5; ++Index)
+	{
+		Scheduler.Enqueue(ESTOMPTrafficLane::Bulk, FrameBytes, [&Sent]() { ++Sent; });
+	}
+	Scheduler.Enqueue(ESTOMPTrafficLane::Bulk, FrameBytes * 3, [&Sent]() { ++Sent; });
+
+	// Every Pump gets a fresh budget, even when no engine frame passes between them
+	int32 Pumps = 0;
+	for (int32 Expected : { 2, 4, 5, 6 })
+	{
+		Scheduler.Pump();
+		TestEqual(FString::Printf(TEXT("Bulk frames sent after Pump %d"), ++Pumps), Sent, Expected);
+	}
+	TestFalse(TEXT("Oversized frame went out alone"), Scheduler.HasQueued());
+	return true;
+}
+
+#endif
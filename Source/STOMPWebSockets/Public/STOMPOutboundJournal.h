@@ -0,0 +1,168 @@
+// Copyright 2020 Richard W. Van Tassel. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Templates/Function.h"
+#include "Async/MappedFileHandle.h"
+#include "STOMPOutboundJournal.generated.h"
+
+class IFileHandle;
+
+/**
+ * What an outbound journal does when a new frame would exceed its size cap.
+ */
+UENUM(BlueprintType)
+enum class ESTOMPJournalOverflowPolicy : uint8
+{
+	/** Evict the oldest unreceipted frames until the new frame fits. */
+	DropOldest,
+	/** Refuse the new frame until receipts free up space. */
+	RejectNew
+};
+
+/**
+ * Append-only, disk-backed store of outbound SEND frames.
+ *
+ * Frames are appended as they are sent and stay in the journal until the server
+ * receipts them, so anything sent while offline (or lost with a dropped connection)
+ * is replayed in order once the client is connected again. Receipts are appended
+ * as small tombstone records; the file is compacted once dead records outweigh
+ * live ones. A frame's first send uses the copy kept from Append; frames recovered
+ * from an earlier session or requeued after a failure are read back through a
+ * memory mapping of the file.
+ */
+class STOMPWEBSOCKETS_API FSTOMPOutboundJournal
+{
+public:
+	/** A journaled SEND frame. */
+	struct FFrame
+	{
+		uint64 Sequence = 0;
+		FString Destination;
+		TMap<FName, FString> Header;
+		TArray<uint8> Body;
+	};
+
+	/**
+	 * @param InPath File backing the journal. Existing contents are recovered by Open.
+	 * @param InMaxBytes Cap on the bytes held by unreceipted frames.
+	 * @param InOverflowPolicy What to do when the cap would be exceeded.
+	 * @param InDrainRate Maximum frames per second sent by Drain. Zero or less means unlimited.
+	 */
+	FSTOMPOutboundJournal(const FString& InPath, int64 InMaxBytes, ESTOMPJournalOverflowPolicy InOverflowPolicy, float InDrainRate);
+	~FSTOMPOutboundJournal();
+
+	FSTOMPOutboundJournal(const FSTOMPOutboundJournal&) = delete;
+	FSTOMPOutboundJournal& operator=(const FSTOMPOutboundJournal&) = delete;
+
+	/**
+	 * Open the journal file, recovering any frames left unreceipted by a previous session.
+	 * @return false if the file could not be opened for writing.
+	 */
+	bool Open();
+
+	/** Flush and release the journal file. Unreceipted frames stay on disk. */
+	void Close();
+
+	bool IsOpen() const { return Writer != nullptr; }
+
+	/** Hand buffered records to the operating system. Close does the full flush to disk. */
+	void Flush();
+
+	/**
+	 * Append a frame to the journal.
+	 * @param OutSequence Receives the sequence number identifying the frame.
+	 * @param OutEvicted Receives the sequence numbers of older frames evicted to make room.
+	 * @return false if the frame was rejected by the overflow policy or could not be written.
+	 */
+	bool Append(const FString& Destination, const TArray<uint8>& Body, const TMap<FName, FString>& Header, uint64& OutSequence, TArray<uint64>& OutEvicted);
+
+	/** Trim a frame from the journal once the server has receipted it. */
+	void Acknowledge(uint64 Sequence);
+
+	/** Drop a frame the server refused, so it is not sent again. */
+	void Discard(uint64 Sequence);
+
+	/**
+	 * Return an in-flight frame to the pending queue so it is sent again.
+	 * Transport failures never use up a frame: it stays journaled until receipted, discarded or evicted.
+	 */
+	void Requeue(uint64 Sequence);
+
+	/** Return every in-flight frame to the pending queue, e.g. after the connection dropped. */
+	void RequeueInFlight();
+
+	/**
+	 * Send pending frames in order, limited by the drain rate.
+	 * Frames handed to SendFrame are in flight until acknowledged or requeued.
+	 * The rate limiter refills from wall time, so calls need not be regular.
+	 * @param OutDropped Receives the sequence numbers of frames dropped because they could not be read back.
+	 * @return The number of frames sent.
+	 */
+	int32 Drain(TFunctionRef<void(const FFrame&)> SendFrame, TArray<uint64>& OutDropped);
+
+	/** Whether any frame is waiting to be sent. */
+	bool HasPending() const;
+
+	/** Number of unreceipted frames, pending or in flight. */
+	int32 Num() const { return Records.Num(); }
+
+	/** Bytes held by unreceipted frames. */
+	int64 GetLiveBytes() const { return LiveBytes; }
+
+	const FString& GetPath() const { return Path; }
+
+private:
+	enum class ERecordKind : uint8
+	{
+		Frame,
+		Receipt
+	};
+
+	enum class ERecordState : uint8
+	{
+		Pending,
+		InFlight
+	};
+
+	/** Location of a live frame record in the file. */
+	struct FRecord
+	{
+		uint64 Sequence;
+		int64 Offset;
+		int64 Size;
+		ERecordState State;
+	};
+
+	bool LoadExisting();
+	bool OpenWriter(bool bAppend);
+	bool WriteRecord(ERecordKind Kind, uint64 Sequence, const TArray<uint8>& Payload, int64& OutOffset, int64& OutSize);
+	bool ReadFrame(const FRecord& Record, FFrame& OutFrame);
+	bool ViewFile(int64 Offset, int64 Size, TArray<uint8>& Scratch, TArrayView<const uint8>& OutView);
+	void ReleaseMapping();
+	int32 FindRecord(uint64 Sequence) const;
+	void RemoveRecord(int32 Index);
+	void MaybeCompact();
+	bool Compact();
+
+	FString Path;
+	int64 MaxBytes;
+	ESTOMPJournalOverflowPolicy OverflowPolicy;
+	float DrainRate;
+	float DrainTokens;
+	double LastDrainSeconds;
+
+	IFileHandle* Writer;
+	TUniquePtr<IMappedFileHandle> MappedFile;
+	TUniquePtr<IMappedFileRegion> MappedRegion;
+
+	/** Live frames ordered by sequence. */
+	TArray<FRecord> Records;
+
+	/** Frames appended this session that have not been sent yet, so their first send does not touch the file. */
+	TMap<uint64, FFrame> UnsentFrames;
+	uint64 NextSequence;
+	int64 FileBytes;
+	int64 LiveBytes;
+};
@@ -0,0 +1,98 @@
+// Copyright 2020 Richard W. Van Tassel. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Templates/Function.h"
+#include "STOMPOutboundScheduler.generated.h"
+
+/**
+ * Priority lane an outbound frame is scheduled on.
+ */
+UENUM(BlueprintType)
+enum class ESTOMPTrafficLane : uint8
+{
+	/** Use the lane set for the destination, or Interactive if there is none. */
+	Default,
+	/** Protocol traffic such as acks and subscriptions. Never queued. */
+	Control,
+	/** Small, latency sensitive messages. */
+	Interactive,
+	/** Large transfers that should yield to everything else. */
+	Bulk
+};
+
+/**
+ * Orders outbound sends so bulk transfers do not hold up latency sensitive traffic.
+ *
+ * Control traffic always goes out immediately. Interactive sends go out immediately
+ * while neither lane has anything queued, and bulk sends do too if they also fit the
+ * remaining bulk budget. Everything else is queued and drained by each Pump using
+ * weighted deficit round robin, so while bulk work is queued, interactive sends wait
+ * for the next Pump and then share each round with bulk by weight. Bulk is capped to a
+ * byte budget per Pump, which counts the immediate bulk sends made since the previous
+ * Pump as well; once it is spent, the rest of the Pump goes to the interactive lane.
+ *
+ * Frames are never split. A bulk frame larger than the budget waits in the queue and
+ * goes out on its own in a later Pump, after the interactive lane has been served, but
+ * once handed to the socket it still delays whatever is sent after it.
+ */
+class STOMPWEBSOCKETS_API FSTOMPOutboundScheduler
+{
+public:
+	FSTOMPOutboundScheduler();
+
+	/** Lane used when a send asks for the Default lane. */
+	ESTOMPTrafficLane ResolveLane(ESTOMPTrafficLane Lane, const FString& Destination) const;
+
+	/** Set the lane used for Default sends to a destination. Default clears it. */
+	void SetDestinationLane(const FString& Destination, ESTOMPTrafficLane Lane);
+
+	/**
+	 * @param InteractiveWeight Share of each drain round given to the interactive lane.
+	 * @param BulkWeight Share of each drain round given to the bulk lane.
+	 * @param BulkBytesPerTick Bulk bytes allowed per Pump. A larger send is queued and goes out alone in a later Pump.
+	 */
+	void Configure(int32 InteractiveWeight, int32 BulkWeight, int32 BulkBytesPerTick);
+
+	/**
+	 * Whether a send can go out right away without overtaking queued sends or exceeding the bulk budget.
+	 * Admitted bulk bytes count against the budget of the next Pump.
+	 */
+	bool TryAdmit(ESTOMPTrafficLane Lane, int32 Bytes);
+
+	/** Queue a send for the next Pump. */
+	void Enqueue(ESTOMPTrafficLane Lane, int32 Bytes, TUniqueFunction<void()>&& Send);
+
+	/** Drain queued sends. Starts a fresh bulk budget, so call it once per tick. */
+	void Pump();
+
+	bool HasQueued() const;
+
+private:
+	struct FOperation
+	{
+		int32 Bytes;
+		TUniqueFunction<void()> Send;
+	};
+
+	struct FLane
+	{
+		TArray<FOperation> Queue;
+		int32 Head = 0;
+		int32 Weight = 1;
+		int64 Deficit = 0;
+
+		bool IsEmpty() const { return Head >= Queue.Num(); }
+	};
+
+	FLane& GetLane(ESTOMPTrafficLane Lane);
+	bool FitsBulkBudget(int32 Bytes) const;
+	static void Compact(FLane& Lane);
+
+	FLane Interactive;
+	FLane Bulk;
+	TMap<FString, ESTOMPTrafficLane> DestinationLanes;
+	int32 BulkBytesPerTick;
+	int64 BulkBytesThisTick;
+};
@@ -0,0 +1,128 @@
+// Copyright 2020 Richard W. Van Tassel. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Templates/Function.h"
+
+class FArchive;
+class IStompMessage;
+
+/**
+ * Records the frames passing through a client into a compact binary capture file.
+ *
+ * Each record holds the direction, the STOMP command, the time since the previous
+ * record, the destination, subscription id, header and body. Captures can be fed back
+ * through a client's dispatch path with FSTOMPTrafficReplay.
+ */
+class STOMPWEBSOCKETS_API FSTOMPTrafficCapture
+{
+public:
+	enum class EDirection : uint8
+	{
+		Inbound,
+		Outbound
+	};
+
+	enum class ECommand : uint8
+	{
+		Message,
+		Send,
+		Subscribe,
+		Unsubscribe,
+		Ack,
+		Nack
+	};
+
+	/** A captured frame. Time is in seconds since the capture started. */
+	struct FFrame
+	{
+		double Time = 0.0;
+		EDirection Direction = EDirection::Inbound;
+		ECommand Command = ECommand::Message;
+		FString Destination;
+		FString SubscriptionId;
+		TMap<FName, FString> Header;
+		TArray<uint8> Body;
+	};
+
+	explicit FSTOMPTrafficCapture(const FString& InPath);
+	~FSTOMPTrafficCapture();
+
+	FSTOMPTrafficCapture(const FSTOMPTrafficCapture&) = delete;
+	FSTOMPTrafficCapture& operator=(const FSTOMPTrafficCapture&) = delete;
+
+	/**
+	 * Create the capture file, replacing any existing one.
+	 * @return false if the file could not be created.
+	 */
+	bool Open();
+
+	/** Flush and close the capture file. */
+	void Close();
+
+	/** Write buffered records out to the capture file. */
+	void Flush();
+
+	/** Append a frame to the capture. */
+	void Record(EDirection Direction, ECommand Command, const FString& Destination, const FString& SubscriptionId,
+		const TMap<FName, FString>& Header, const uint8* Body = nullptr, int32 BodyLength = 0);
+
+	/** Append an inbound MESSAGE frame. */
+	void RecordMessage(const IStompMessage& Message);
+
+	/**
+	 * Read a whole capture file.
+	 * @return false if the file is missing or is not a capture.
+	 */
+	static bool Load(const FString& Path, TArray<FFrame>& OutFrames);
+
+private:
+	FString Path;
+	TUniquePtr<FArchive> Writer;
+	double StartSeconds;
+	uint64 LastMicroseconds;
+};
+
+/**
+ * Plays the inbound MESSAGE frames of a capture back on a schedule.
+ * Frames are handed to a dispatch function, so no network is involved.
+ *
+ * Each message is routed by the destination of the captured SUBSCRIBE for its
+ * subscription id, since brokers often deliver to a different destination than the
+ * one subscribed to (user prefixes, wildcards). Messages whose SUBSCRIBE was not
+ * captured fall back to their own destination.
+ */
+class STOMPWEBSOCKETS_API FSTOMPTrafficReplay
+{
+public:
+	/**
+	 * @param InFrames Captured frames. Subscriptions are used for routing and only inbound messages are kept.
+	 * @param InSpeed Playback speed multiplier. Zero or less plays everything as fast as possible.
+	 */
+	FSTOMPTrafficReplay(TArray<FSTOMPTrafficCapture::FFrame>&& InFrames, float InSpeed);
+
+	/**
+	 * Advance playback and dispatch every frame that has come due.
+	 * At max speed every remaining frame is dispatched at once.
+	 * @param Dispatch Called with each frame and the destination its subscription was made on.
+	 * @return true once every frame has been dispatched.
+	 */
+	bool Step(float DeltaTime, TFunctionRef<void(const FSTOMPTrafficCapture::FFrame&, const FString&)> Dispatch);
+
+	bool IsFinished() const { return Cursor >= Frames.Num(); }
+	bool IsMaxSpeed() const { return Speed <= 0.f; }
+
+	/** Human readable throughput and dispatch cost of the replay so far. */
+	FString GetSummary() const;
+
+private:
+	TArray<FSTOMPTrafficCapture::FFrame> Frames;
+	/** Routing destination of each frame. */
+	TArray<FString> SubscribedDestinations;
+	int32 Cursor;
+	double Clock;
+	float Speed;
+	double StartSeconds;
+	uint64 DispatchCycles;
+};
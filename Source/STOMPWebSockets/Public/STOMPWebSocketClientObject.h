@@ -3,6 +3,8 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "STOMPOutboundJournal.h"
+#include "STOMPOutboundScheduler.h"
 #include "STOMPWebSocketClientObject.generated.h"
 
 DECLARE_DYNAMIC_DELEGATE_TwoParams(FSTOMPRequestCompletedObject, bool, bSuccess, const FString&, Error);
@@ -19,7 +21,14 @@ class STOMPWEBSOCKETS_API USTOMPWebSocketClientObject : public UObject
 {
 	GENERATED_BODY()
 
+public:
+	USTOMPWebSocketClientObject();
+
+	static void AddReferencedObjects(UObject* InThis, FReferenceCollector& Collector);
+
 protected:
+	virtual void BeginDestroy() override;
+
 	TSharedPtr<class IStompClient> StompClient;
 
 
@@ -29,12 +38,22 @@ private:
 	void HandleOnConnectionError(const FString& Error);
 	void HandleOnError(const FString& Error);
 	void HandleOnClosed(const FString& Reason);
+
+	//Queued work runs on the ticker shared by all clients
+	void UpdateQueuedWork();
+	bool TickQueuedWork(float DeltaTime);
+
 	UPROPERTY(BlueprintSetter = SetUrl, BlueprintGetter = GetUrl, Category = "Online|STOMP over Websockets")
 	FString Url;
 	UPROPERTY(BlueprintSetter = SetAuthToken, BlueprintGetter = GetAuthToken, Category = "Online|STOMP over Websockets")
 	FString AuthToken;
 
-public:	
+	//Subscriptions, scheduling, journal, capture and replay shared with USTOMPWebSocketClient
+	TSharedPtr<class FSTOMPClientCore> Core;
+
+	FDelegateHandle QueuedWorkHandle;
+
+public:
 	UFUNCTION(BlueprintCallable, BlueprintSetter, Category = "Online|STOMP over Websockets")
 	void SetUrl(FString NewUrl);
 
@@ -47,6 +66,17 @@ public:
 	UFUNCTION(BlueprintCallable, BlueprintGetter, Category = "Online|STOMP over Websockets")
 	FString GetAuthToken();
 
+	/**
+	 * Reuse message objects between deliveries instead of creating one per inbound frame.
+	 * Off by default. While on, a message object kept past its subscription callback is handed out
+	 * again for a later frame, so handlers that keep messages must call Retain on them.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Online|STOMP over Websockets|Messages")
+	void SetRecycleMessages(bool bNewRecycleMessages);
+
+	UFUNCTION(BlueprintCallable, Category = "Online|STOMP over Websockets|Messages")
+	bool GetRecycleMessages();
+
 	/**
 	 * Initialize STOMP controller
 	 */
@@ -78,6 +108,7 @@ public:
 
 	/**
 	 * Subscribe to an event
+	 * Fails with an empty handle if the client has not been built; see SubscribeForReplay for offline replay.
 	 * @param Destination Destination endpoint to subscribe to.
 	 * @param EventCallback Delegate called when events arrive on this subscription.
 	 * @param CompletionCallback Delegate called when the request has been acknowledged by the server or if there is an error.
@@ -86,6 +117,16 @@ public:
 	UFUNCTION(BlueprintCallable, meta = (AutoCreateRefTerm = "CompletionCallback"), Category = "Online|STOMP over Websockets")
 	FString Subscribe(const FString& Destination, const FSTOMPSubscriptionEventObject& EventCallback, const FSTOMPRequestCompletedObject& CompletionCallback);
 
+	/**
+	 * Subscribe to messages replayed by ReplayCapture, without subscribing on the server.
+	 * Works before the client is built and is kept when it is built again.
+	 * @param Destination Destination endpoint the captured messages were subscribed on.
+	 * @param EventCallback Delegate called when replayed messages arrive on this subscription.
+	 * @return a handle to the subscription. Can be passed to Unsubscribe to remove it.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Online|STOMP over Websockets|Capture")
+	FString SubscribeForReplay(const FString& Destination, const FSTOMPSubscriptionEventObject& EventCallback);
+
 	/**
 	 * Unsubscribe from an event
 	 * @param Subscription The id returned from the call to Subscribe.
@@ -101,14 +142,15 @@ public:
 	 * @param Body The event body as string. It will be encoded as UTF8 before sending to the Stomp server.
 	 * @param Header Custom header values to send along with the data.
 	 * @param CompletionCallback Delegate called when the request has been acknowledged by the server or if there is an error.
+	 * @param Lane Outbound lane to schedule the frame on. Default uses the lane set with SetDestinationLane, or Interactive.
 	 */
 	UFUNCTION(BlueprintCallable, meta = (AutoCreateRefTerm = "Header,CompletionCallback"), Category = "Online|STOMP over Websockets")
-	void SendString(const FString& Destination, const FString& Body, const TMap<FName, FString>& Header, const FSTOMPRequestCompletedObject& CompletionCallback)
+	void SendString(const FString& Destination, const FString& Body, const TMap<FName, FString>& Header, const FSTOMPRequestCompletedObject& CompletionCallback, ESTOMPTrafficLane Lane = ESTOMPTrafficLane::Default)
 	{
 		FTCHARToUTF8 Convert(*Body);
 		TArray<uint8> Encoded;
 		Encoded.Append((uint8*)Convert.Get(), Convert.Length());
-		SendBinary(Destination, Encoded, Header, CompletionCallback);
+		SendBinary(Destination, Encoded, Header, CompletionCallback, Lane);
 	}
 
 	/**
@@ -117,9 +159,94 @@ public:
 	 * @param Body The event body as a binary blob.
 	 * @param Header Custom header values to send along with the data.
 	 * @param CompletionCallback Delegate called when the request has been acknowledged by the server or if there is an error.
+	 * @param Lane Outbound lane to schedule the frame on. Default uses the lane set with SetDestinationLane, or Interactive.
 	 */
 	UFUNCTION(BlueprintCallable, meta = (AutoCreateRefTerm = "Header,CompletionCallback"), Category = "Online|STOMP over Websockets")
-	void SendBinary(const FString& Destination, const TArray<uint8>& Body, const TMap<FName, FString>& Header, const FSTOMPRequestCompletedObject& CompletionCallback);
+	void SendBinary(const FString& Destination, const TArray<uint8>& Body, const TMap<FName, FString>& Header, const FSTOMPRequestCompletedObject& CompletionCallback, ESTOMPTrafficLane Lane = ESTOMPTrafficLane::Default);
+
+	/**
+	 * Set the outbound lane used for sends to a destination that ask for the Default lane.
+	 * Journaled frames are not scheduled; the journal's drain rate paces them instead.
+	 * @param Destination The destination endpoint.
+	 * @param Lane Lane for the destination. Default goes back to Interactive.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Online|STOMP over Websockets")
+	void SetDestinationLane(const FString& Destination, ESTOMPTrafficLane Lane);
+
+	/**
+	 * Tune how queued interactive and bulk sends are drained each tick. Control traffic is never queued.
+	 * While bulk sends are queued, interactive sends queue behind them and each tick is shared between the lanes by weight.
+	 * @param InteractiveWeight Share of each drain round given to the interactive lane.
+	 * @param BulkWeight Share of each drain round given to the bulk lane.
+	 * @param BulkBytesPerTick Cap on bulk body bytes sent per tick. Frames are not split: a larger one is queued
+	 * and goes out alone in a later tick, after queued interactive sends.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Online|STOMP over Websockets")
+	void SetOutboundSchedule(int32 InteractiveWeight = 4, int32 BulkWeight = 1, int32 BulkBytesPerTick = 65536);
+
+	/**
+	 * Enable store-and-forward for outbound frames.
+	 * SendString and SendBinary append to a journal on disk that is drained in order while connected.
+	 * Frames stay journaled until the server receipts them, so anything sent while offline or lost
+	 * with a dropped connection is sent again after reconnecting.
+	 * While the journal is enabled, send completion callbacks fire once the frame is receipted, or with
+	 * an error if the journal rejects or evicts the frame, the server refuses it, or the journal is disabled.
+	 * Callbacks still outstanding when this object is garbage collected are dropped without being called.
+	 * @param JournalPath File backing the journal. Frames left unreceipted by an earlier session are recovered from it.
+	 * @param MaxBytes Cap on the size of the unreceipted frames held by the journal.
+	 * @param OverflowPolicy What to do when a new frame would exceed MaxBytes.
+	 * @param DrainRate Maximum frames per second sent from the journal. Zero means unlimited.
+	 * @return true if the journal file could be opened.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Online|STOMP over Websockets")
+	bool EnableOutboundJournal(const FString& JournalPath, int64 MaxBytes = 16777216, ESTOMPJournalOverflowPolicy OverflowPolicy = ESTOMPJournalOverflowPolicy::DropOldest, float DrainRate = 100.f);
+
+	/**
+	 * Stop journaling outbound frames.
+	 * Unreceipted frames stay on disk and are recovered when the journal is enabled again on the same file.
+	 * Their completion callbacks fire with an error, since this session will no longer hear back about them.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Online|STOMP over Websockets")
+	void DisableOutboundJournal();
+
+	/**
+	 * Number of journaled frames the server has not receipted yet.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Online|STOMP over Websockets")
+	int32 GetJournaledFrameCount();
+
+	/**
+	 * Start recording every frame sent or received by this client into a capture file.
+	 * @param CapturePath File to write the capture to. An existing file is replaced.
+	 * @return true if the capture file could be created.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Online|STOMP over Websockets|Capture")
+	bool StartCapture(const FString& CapturePath);
+
+	/**
+	 * Stop recording and close the capture file.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Online|STOMP over Websockets|Capture")
+	void StopCapture();
+
+	/**
+	 * Feed the inbound messages of a capture through this client's subscriptions without any network traffic.
+	 * Each captured message is delivered to the subscriptions on the destination it was captured subscribing to,
+	 * or on its own destination if the capture does not include that subscription. Use SubscribeForReplay
+	 * to replay captures offline, without a built client.
+	 * @param CapturePath File written by an earlier StartCapture.
+	 * @param Speed Playback speed multiplier. Zero delivers every message at once, as fast as possible.
+	 * @param CompletionCallback Delegate called when the replay has finished or if the capture could not be read.
+	 * @return true if the capture could be read.
+	 */
+	UFUNCTION(BlueprintCallable, meta = (AutoCreateRefTerm = "CompletionCallback"), Category = "Online|STOMP over Websockets|Capture")
+	bool ReplayCapture(const FString& CapturePath, float Speed, const FSTOMPRequestCompletedObject& CompletionCallback);
+
+	/**
+	 * Abandon a replay in progress.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Online|STOMP over Websockets|Capture")
+	void StopReplay();
 
 	/**
 	 * Delegate called when a connection been established successfully.
@@ -5,25 +5,51 @@
 #include "CoreMinimal.h"
 #include "STOMPWebSocketClient.h"
 #include "STOMPWebSocketClientObject.h"
+#include "STOMPTrafficCapture.h"
 #include "STOMPWebSocketMessage.generated.h"
 
 class IStompMessage;
 
 
+/**
+ * A message delivered to a subscription callback.
+ * The message is only readable during the callback. Call Retain to keep reading it afterwards,
+ * which also keeps a client that recycles message objects from handing it out again.
+ */
 UCLASS(meta = (DisplayName="STOMP Web Socket Message"))
 class USTOMPWebSocketMessage : public UObject
 {
 	GENERATED_BODY()
 
-	friend USTOMPWebSocketClient;
-	friend USTOMPWebSocketClientObject;
+	friend class FSTOMPClientCore;
 
 private:
 	const IStompMessage* MyMessage;
+	TWeakPtr<class FSTOMPTrafficCapture> TrafficCapture;
+
+	//Heap copy made by Retain, read once the delivering callback has returned
+	TUniquePtr<FSTOMPTrafficCapture::FFrame> RetainedFrame;
+	TUniquePtr<class FSTOMPReplayMessage> RetainedMessage;
+
+	const IStompMessage* GetMessage() const;
+
+	/** Detach from the delivered frame. Returns false if the message was retained and must not be recycled. */
+	bool Release();
 
 public:
-	virtual ~USTOMPWebSocketMessage()
-	{ }
+	virtual ~USTOMPWebSocketMessage();
+
+	/**
+	 * Keep this message readable after the subscription callback returns.
+	 * The frame is copied to the heap and the message object is neither destroyed nor recycled by the client;
+	 * hold it in a UPROPERTY to keep it alive.
+	 * Ack and Nack only work from within the callback that delivered the message.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Online|STOMP over Websockets|Messages")
+	void Retain();
+
+	UFUNCTION(BlueprintCallable, Category = "Online|STOMP over Websockets|Messages")
+	bool IsRetained() const;
 
 	UFUNCTION(BlueprintCallable, meta = (AutoCreateRefTerm = "Header,CompletionCallback"), Category = "Online|STOMP over Websockets|Messages")
 	void Ack(const TMap<FName, FString>& Header, const FSTOMPRequestCompleted& CompletionCallback);
@@ -2,8 +2,11 @@
 
 #pragma once
 
+#include "CoreMinimal.h"
 #include "Modules/ModuleManager.h"
 
+STOMPWEBSOCKETS_API DECLARE_LOG_CATEGORY_EXTERN(LogSTOMPWebSockets, Log, All);
+
 class FSTOMPWebSocketsModule : public IModuleInterface
 {
 private:
@@ -12,4 +15,10 @@ private:
 	 * Initialize implementation specific parts of Stomp handling
 	 */
 	virtual void StartupModule() override;
+
+	/**
+	 * Called before the module is unloaded
+	 * Releases engine registrations shared by the clients
+	 */
+	virtual void ShutdownModule() override;
 };
@@ -0,0 +1,368 @@
+// Copyright 2020 Richard W. Van Tassel. All Rights Reserved.
+
+#include "STOMPLoadTestCommandlet.h"
+#include "STOMPWebSockets.h"
+#include "StompModule.h"
+#include "IStompClient.h"
+#include "IStompMessage.h"
+#include "Async/TaskGraphInterfaces.h"
+#include "Containers/Ticker.h"
+#include "HAL/PlatformMemory.h"
+#include "HAL/PlatformProcess.h"
+#include "HAL/PlatformTime.h"
+#include "Math/RandomStream.h"
+#include "Misc/Parse.h"
+
+namespace STOMPLoadTest
+{
+	/** Carries the send time so receivers in this process can measure delivery latency. */
+	static const FName SentHeader(TEXT("x-loadtest-sent"));
+
+	struct FSettings
+	{
+		FString Url;
+		FString AuthToken;
+		FString Destination = TEXT("/topic/loadtest");
+		int32 Sessions = 100;
+		int32 Topics = 1;
+		float Duration = 30.f;
+		float RampUp = 10.f;
+		float SendRate = 1.f;
+		int32 PayloadBytes = 256;
+		float SubscribeRatio = 1.f;
+		float AckRatio = 0.f;
+		int32 Seed = 0;
+	};
+
+	/**
+	 * Latency distribution in fixed log-scale buckets, so memory stays constant however many samples a run produces.
+	 * Buckets are about 4.4% wide between 0.01 ms and roughly 168 s; percentiles report the bucket's midpoint.
+	 */
+	class FLatencyHistogram
+	{
+	public:
+		FLatencyHistogram()
+		{
+			FMemory::Memzero(Counts, sizeof(Counts));
+		}
+
+		void Add(double Ms)
+		{
+			const int32 Bucket = Ms <= MinMs ? 0 : FMath::Min(FMath::FloorToInt(FMath::Log2(Ms / MinMs) * BucketsPerOctave), NumBuckets - 1);
+			++Counts[Bucket];
+			++Total;
+			MaxMs = FMath::Max(MaxMs, Ms);
+		}
+
+		int64 Num() const { return Total; }
+		double GetMax() const { return MaxMs; }
+
+		double Percentile(double Fraction) const
+		{
+			const int64 Rank = FMath::Clamp<int64>((int64)FMath::CeilToDouble(Fraction * Total), 1, Total);
+			int64 Seen = 0;
+			for (int32 Bucket = 0; Bucket < NumBuckets; ++Bucket)
+			{
+				Seen += Counts[Bucket];
+				if (Seen >= Rank)
+				{
+					return FMath::Min(MinMs * FMath::Pow(2.0, (Bucket + 0.5) / BucketsPerOctave), MaxMs);
+				}
+			}
+			return MaxMs;
+		}
+
+	private:
+		static constexpr double MinMs = 0.01;
+		static constexpr int32 BucketsPerOctave = 16;
+		static constexpr int32 NumBuckets = 24 * BucketsPerOctave;
+
+		int64 Counts[NumBuckets];
+		int64 Total = 0;
+		double MaxMs = 0.0;
+	};
+
+	struct FStats
+	{
+		int64 Sent = 0;
+		int64 Receipted = 0;
+		int64 Received = 0;
+		int64 Acked = 0;
+		int64 Errors = 0;
+		int64 ConnectionErrors = 0;
+		int32 Connected = 0;
+		int32 PeakConnected = 0;
+		uint64 PeakUsedPhysical = 0;
+		FLatencyHistogram ReceiptLatencyMs;
+		FLatencyHistogram DeliveryLatencyMs;
+	};
+
+	struct FSession
+	{
+		TSharedPtr<IStompClient> Client;
+		FString Destination;
+		double ConnectTime = 0.0;
+		double NextSendTime = 0.0;
+		bool bSubscriber = false;
+		bool bConnectStarted = false;
+		bool bConnected = false;
+	};
+
+	static FString FormatPercentiles(const FLatencyHistogram& Samples)
+	{
+		if (Samples.Num() == 0)
+		{
+			return TEXT("no samples");
+		}
+
+		return FString::Printf(TEXT("p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms (%lld samples)"),
+			Samples.Percentile(0.5), Samples.Percentile(0.9), Samples.Percentile(0.99), Samples.GetMax(), Samples.Num());
+	}
+
+	static void Pump(float DeltaTime)
+	{
+		FTaskGraphInterface::Get().ProcessThreadUntilIdle(ENamedThreads::GameThread);
+		FTSTicker::GetCoreTicker().Tick(DeltaTime);
+	}
+}
+
+USTOMPLoadTestCommandlet::USTOMPLoadTestCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = false;
+	LogToConsole = true;
+
+	HelpDescription = TEXT("Simulates many STOMP over WebSocket clients against a broker and reports throughput, latency and memory use.");
+	HelpUsage = TEXT("-run=STOMPLoadTest -Url=ws://host:port/path [options]");
+	HelpParamNames = {
+		TEXT("Url"), TEXT("AuthToken"), TEXT("Sessions"), TEXT("Duration"), TEXT("RampUp"), TEXT("Destination"), TEXT("Topics"),
+		TEXT("SendRate"), TEXT("PayloadBytes"), TEXT("SubscribeRatio"), TEXT("AckRatio"), TEXT("Seed")
+	};
+	HelpParamDescriptions = {
+		TEXT("Broker endpoint, required."),
+		TEXT("Auth token passed to every session."),
+		TEXT("Number of concurrent sessions. Default 100."),
+		TEXT("Seconds to run after ramp-up. Default 30."),
+		TEXT("Seconds over which sessions connect. Default 10."),
+		TEXT("Base destination. Default /topic/loadtest."),
+		TEXT("Spread sessions over this many destinations, suffixed /0../N-1 when above 1. Default 1."),
+		TEXT("Messages per second sent by each session. Default 1."),
+		TEXT("Message body size. Default 256."),
+		TEXT("Fraction of sessions that subscribe. Default 1."),
+		TEXT("Fraction of received messages acknowledged. Needs a broker that delivers with ack ids. Default 0."),
+		TEXT("Seed for the session mix. Default 0.")
+	};
+}
+
+int32 USTOMPLoadTestCommandlet::Main(const FString& Params)
+{
+	using namespace STOMPLoadTest;
+
+	FSettings Settings;
+	if (!FParse::Value(*Params, TEXT("Url="), Settings.Url))
+	{
+		UE_LOG(LogSTOMPWebSockets, Error, TEXT("Usage: %s"), *HelpUsage);
+		return 1;
+	}
+
+	FParse::Value(*Params, TEXT("AuthToken="), Settings.AuthToken);
+	FParse::Value(*Params, TEXT("Destination="), Settings.Destination);
+	FParse::Value(*Params, TEXT("Sessions="), Settings.Sessions);
+	FParse::Value(*Params, TEXT("Topics="), Settings.Topics);
+	FParse::Value(*Params, TEXT("Duration="), Settings.Duration);
+	FParse::Value(*Params, TEXT("RampUp="), Settings.RampUp);
+	FParse::Value(*Params, TEXT("SendRate="), Settings.SendRate);
+	FParse::Value(*Params, TEXT("PayloadBytes="), Settings.PayloadBytes);
+	FParse::Value(*Params, TEXT("SubscribeRatio="), Settings.SubscribeRatio);
+	FParse::Value(*Params, TEXT("AckRatio="), Settings.AckRatio);
+	FParse::Value(*Params, TEXT("Seed="), Settings.Seed);
+
+	Settings.Sessions = FMath::Max(Settings.Sessions, 1);
+	Settings.Topics = FMath::Max(Settings.Topics, 1);
+	Settings.RampUp = FMath::Max(Settings.RampUp, 0.f);
+
+	UE_LOG(LogSTOMPWebSockets, Display, TEXT("Load test: %d sessions against %s, %.1f msg/s each, %d byte payloads, %.0f%% subscribers, %.0f%% acks"),
+		Settings.Sessions, *Settings.Url, Settings.SendRate, Settings.PayloadBytes, Settings.SubscribeRatio * 100.f, Settings.AckRatio * 100.f);
+
+	// IStompClient is not thread safe, so every session is driven from this thread while
+	// socket IO runs on the WebSockets module's own service thread
+	FStompModule& StompModule = FStompModule::Get();
+	FRandomStream Random(Settings.Seed);
+	FStats Stats;
+
+	TArray<uint8> Payload;
+	Payload.Init('x', FMath::Max(Settings.PayloadBytes, 0));
+
+	const uint64 UsedPhysicalBefore = FPlatformMemory::GetStats().UsedPhysical;
+	const double StartTime = FPlatformTime::Seconds();
+
+	// Callbacks refer to sessions by index, so the array must not grow once they are bound
+	TArray<FSession> Sessions;
+	Sessions.SetNum(Settings.Sessions);
+	for (int32 Index = 0; Index < Sessions.Num(); ++Index)
+	{
+		FSession& Session = Sessions[Index];
+		Session.Client = StompModule.CreateClient(Settings.Url, Settings.AuthToken);
+		Session.Destination = Settings.Topics > 1 ? FString::Printf(TEXT("%s/%d"), *Settings.Destination, Index % Settings.Topics) : Settings.Destination;
+		Session.ConnectTime = StartTime + Settings.RampUp * Index / Sessions.Num();
+		Session.bSubscriber = Random.FRand() < Settings.SubscribeRatio;
+
+		Session.Client->OnConnected().AddLambda([&Sessions, &Stats, &Settings, &Random, Index](const FString&, const FString&, const FString&)
+		{
+			FSession& Connected = Sessions[Index];
+			Connected.bConnected = true;
+			Stats.PeakConnected = FMath::Max(Stats.PeakConnected, ++Stats.Connected);
+
+			// Spread sends over the first interval so sessions do not fire in lockstep
+			Connected.NextSendTime = FPlatformTime::Seconds() + (Settings.SendRate > 0.f ? Random.FRand() / Settings.SendRate : 0.f);
+
+			if (Connected.bSubscriber)
+			{
+				Connected.Client->Subscribe(Connected.Destination,
+					FStompSubscriptionEvent::CreateLambda([&Stats, &Settings, &Random](const IStompMessage& Message)->void {
+						++Stats.Received;
+
+						const FString* Sent = Message.GetHeader().Find(SentHeader);
+						if (Sent)
+						{
+							const uint64 SentCycles = FCString::Strtoui64(**Sent, nullptr, 10);
+							Stats.DeliveryLatencyMs.Add(FPlatformTime::ToMilliseconds64(FPlatformTime::Cycles64() - SentCycles));
+						}
+
+						if (Settings.AckRatio > 0.f && Random.FRand() < Settings.AckRatio)
+						{
+							Message.Ack(TMap<FName, FString>(), FStompRequestCompleted::CreateLambda([&Stats](bool bSuccess, const FString& Error)->void {
+								if (bSuccess)
+								{
+									++Stats.Acked;
+								}
+								else
+								{
+									++Stats.Errors;
+								}
+							}));
+						}
+					}),
+					FStompRequestCompleted::CreateLambda([&Stats](bool bSuccess, const FString& Error)->void {
+						if (!bSuccess)
+						{
+							++Stats.Errors;
+						}
+					})
+				);
+			}
+		});
+		Session.Client->OnConnectionError().AddLambda([&Stats](const FString& Error)
+		{
+			++Stats.ConnectionErrors;
+		});
+		Session.Client->OnError().AddLambda([&Stats](const FString& Error)
+		{
+			++Stats.Errors;
+		});
+		Session.Client->OnClosed().AddLambda([&Sessions, &Stats, Index](const FString& Reason)
+		{
+			if (Sessions[Index].bConnected)
+			{
+				Sessions[Index].bConnected = false;
+				--Stats.Connected;
+			}
+		});
+	}
+
+	const uint64 UsedPhysicalClients = FPlatformMemory::GetStats().UsedPhysical;
+	const double EndTime = StartTime + Settings.RampUp + Settings.Duration;
+	double LastTime = StartTime;
+	double NextProgressTime = StartTime + 5.0;
+
+	while (!IsEngineExitRequested())
+	{
+		const double Now = FPlatformTime::Seconds();
+		if (Now >= EndTime)
+		{
+			break;
+		}
+
+		Pump(Now - LastTime);
+		LastTime = Now;
+
+		for (FSession& Session : Sessions)
+		{
+			if (!Session.bConnectStarted && Now >= Session.ConnectTime)
+			{
+				Session.bConnectStarted = true;
+				Session.Client->Connect();
+			}
+
+			if (!Session.bConnected || Settings.SendRate <= 0.f || Now < Session.NextSendTime)
+			{
+				continue;
+			}
+
+			// Skip sends that fell more than a second behind rather than bursting to catch up
+			Session.NextSendTime = FMath::Max(Session.NextSendTime + 1.0 / Settings.SendRate, Now - 1.0);
+
+			const uint64 SendCycles = FPlatformTime::Cycles64();
+			TMap<FName, FString> Header;
+			Header.Add(SentHeader, LexToString(SendCycles));
+
+			++Stats.Sent;
+			Session.Client->Send(Session.Destination, Payload, Header,
+				FStompRequestCompleted::CreateLambda([&Stats, SendCycles](bool bSuccess, const FString& Error)->void {
+					if (bSuccess)
+					{
+						++Stats.Receipted;
+						Stats.ReceiptLatencyMs.Add(FPlatformTime::ToMilliseconds64(FPlatformTime::Cycles64() - SendCycles));
+					}
+					else
+					{
+						++Stats.Errors;
+					}
+				})
+			);
+		}
+
+		Stats.PeakUsedPhysical = FMath::Max(Stats.PeakUsedPhysical, FPlatformMemory::GetStats().UsedPhysical);
+		if (Now >= NextProgressTime)
+		{
+			NextProgressTime += 5.0;
+			UE_LOG(LogSTOMPWebSockets, Display, TEXT("%.0f s: %d connected, %lld sent, %lld received, %lld errors"),
+				Now - StartTime, Stats.Connected, Stats.Sent, Stats.Received, Stats.Errors + Stats.ConnectionErrors);
+		}
+
+		FPlatformProcess::Sleep(0.001f);
+	}
+
+	const double Elapsed = FPlatformTime::Seconds() - StartTime;
+
+	for (FSession& Session : Sessions)
+	{
+		if (Session.bConnected)
+		{
+			Session.Client->Disconnect();
+		}
+	}
+
+	// Give DISCONNECT frames a moment to go out before the clients are torn down
+	const double DrainEnd = FPlatformTime::Seconds() + 1.0;
+	for (double Now = FPlatformTime::Seconds(); Now < DrainEnd; Now = FPlatformTime::Seconds())
+	{
+		Pump(0.01f);
+		FPlatformProcess::Sleep(0.01f);
+	}
+	Sessions.Empty();
+
+	const double SessionsCount = Settings.Sessions;
+	UE_LOG(LogSTOMPWebSockets, Display, TEXT("Sessions: %d created, %d connected at peak, %lld connection errors"),
+		Settings.Sessions, Stats.PeakConnected, Stats.ConnectionErrors);
+	UE_LOG(LogSTOMPWebSockets, Display, TEXT("Throughput over %.1f s: %.1f sent/s, %.1f receipted/s, %.1f received/s, %lld acked, %lld errors"),
+		Elapsed, Stats.Sent / Elapsed, Stats.Receipted / Elapsed, Stats.Received / Elapsed, Stats.Acked, Stats.Errors);
+	UE_LOG(LogSTOMPWebSockets, Display, TEXT("Receipt latency: %s"), *FormatPercentiles(Stats.ReceiptLatencyMs));
+	UE_LOG(LogSTOMPWebSockets, Display, TEXT("Delivery latency: %s"), *FormatPercentiles(Stats.DeliveryLatencyMs));
+	UE_LOG(LogSTOMPWebSockets, Display, TEXT("Memory per session: %.1f KiB idle client, %.1f KiB at peak"),
+		(int64)(UsedPhysicalClients - UsedPhysicalBefore) / SessionsCount / 1024.0,
+		(int64)(FMath::Max(Stats.PeakUsedPhysical, UsedPhysicalBefore) - UsedPhysicalBefore) / SessionsCount / 1024.0);
+
+	return Stats.PeakConnected > 0 ? 0 : 1;
+}
@@ -0,0 +1,28 @@
+// Copyright 2020 Richard W. Van Tassel. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "STOMPLoadTestCommandlet.generated.h"
+
+/**
+ * Headless load generator that simulates many STOMP clients against a broker.
+ *
+ * Sessions connect over a ramp-up period, subscribe and send according to the
+ * configured mix, and the run ends with a report of throughput, latency
+ * percentiles and memory per session.
+ *
+ * Example:
+ *   UnrealEditor-Cmd MyProject -run=STOMPLoadTest -Url=ws://localhost:15674/ws -Sessions=2000 -Duration=60
+ */
+UCLASS()
+class USTOMPLoadTestCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	USTOMPLoadTestCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+};
@@ -0,0 +1,6 @@
+// Copyright 2020 Richard W. Van Tassel. All Rights Reserved.
+
+#include "Modules/ModuleManager.h"
+
+// Developer tooling kept out of the runtime module, such as the STOMPLoadTest commandlet
+IMPLEMENT_MODULE(FDefaultModuleImpl, STOMPWebSocketsDeveloper)
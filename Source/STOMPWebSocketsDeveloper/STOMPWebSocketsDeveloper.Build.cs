@@ -0,0 +1,22 @@
+// Copyright 2020 Richard W. Van Tassel. All Rights Reserved.
+
+using UnrealBuildTool;
+
+public class STOMPWebSocketsDeveloper : ModuleRules
+{
+	public STOMPWebSocketsDeveloper(ReadOnlyTargetRules Target) : base(Target)
+	{
+		PCHUsage = ModuleRules.PCHUsageMode.UseExplicitOrSharedPCHs;
+
+		PrivateDependencyModuleNames.AddRange(
+			new string[]
+			{
+				"Core",
+				"CoreUObject",
+				"Engine",
+				"Stomp",
+				"STOMPWebSockets"
+			}
+			);
+	}
+}